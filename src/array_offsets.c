@@ -0,0 +1,110 @@
+
+#include "passes.h"
+
+// An element with a constant index is reached through the that segment: the
+// index moves into the that command instead of being added to the base, and
+// a base that pointer 1 already holds is not set again.
+
+static bool is_constant(IrInstr *instr) {
+  return instr->op == IR_PUSH && instr->arg == SEGMENT_CONST;
+}
+
+static bool is_that_access(IrInstr *instr) {
+  return (instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == SEGMENT_THAT;
+}
+
+// "push constant k; push X; add; pop pointer 1; push|pop that j", or with
+// the two pushes the other way round, becomes "push X; pop pointer 1;
+// push|pop that j+k"
+static int fold_offsets(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  int changes = 0;
+
+  for (int i = 1; i + 4 < ir->len; i++) {
+    IrInstr *code = &ir->code[i];
+    if (code[0].op != IR_PUSH || code[1].op != IR_PUSH) continue;
+    if (code[2].op != IR_ARITHMETIC || code[2].arg != ADD) continue;
+    if (code[3].op != IR_POP || code[3].arg != SEGMENT_POINTER || code[3].operand != 1) continue;
+    if (!is_that_access(&code[4])) continue;
+
+    int constant = is_constant(&code[0]) ? 0 : 1;
+    if (!is_constant(&code[constant]) || code[4].operand + code[constant].operand > INT16_MAX) continue;
+
+    IrInstr replacement[3] = {code[1 - constant], code[3], code[4]};
+    replacement[2].operand += code[constant].operand;
+    pass_remark(ctx, REMARK_PASSED, ir->lines[i], 2, "element %i %s through that %i",
+                code[constant].operand, code[4].op == IR_PUSH ? "read" : "written", replacement[2].operand);
+    ir_replace(ir, i, 5, replacement, 3);
+    changes++;
+  }
+  return changes;
+}
+
+// values of these segments only change through a pop to them, or for this
+// and static through a callee or another pointer
+static bool is_trackable(IrInstr *push) {
+  switch (push->arg) {
+    case SEGMENT_CONST: case SEGMENT_LOCAL: case SEGMENT_ARG: case SEGMENT_TEMP:
+    case SEGMENT_STATIC: case SEGMENT_THIS:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool clobbers(IrInstr *instr, IrInstr *base) {
+  switch (instr->op) {
+    case IR_POP:
+      if (instr->arg == base->arg && instr->operand == base->operand) return true;
+      if (base->arg == SEGMENT_THIS) {
+        return (instr->arg == SEGMENT_POINTER && instr->operand == 0) || instr->arg == SEGMENT_THAT;
+      }
+      return false;
+    case IR_CALL:
+      // pointer 1 comes back from a call, but not what a callee stores
+      return base->arg == SEGMENT_STATIC || base->arg == SEGMENT_THIS || base->arg == SEGMENT_TEMP;
+    default:
+      return false;
+  }
+}
+
+// drops "push X; pop pointer 1" where pointer 1 still holds X; whatever
+// pointer 1 held is forgotten at labels, where other paths join
+static int reuse_bases(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  IrInstr base;
+  bool known = false;
+  int changes = 0;
+
+  for (int i = 1; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    bool setsThat = i + 1 < ir->len && instr->op == IR_PUSH && ir->code[i + 1].op == IR_POP &&
+                    ir->code[i + 1].arg == SEGMENT_POINTER && ir->code[i + 1].operand == 1;
+
+    if (setsThat) {
+      if (known && instr->arg == base.arg && instr->operand == base.operand) {
+        pass_remark(ctx, REMARK_PASSED, ir->lines[i], 2, "pointer 1 already holds the array");
+        ir_remove(ir, i, 2);
+        i--;
+        changes++;
+        continue;
+      }
+      base = *instr;
+      known = is_trackable(instr);
+      i++;
+      continue;
+    }
+
+    if (instr->op == IR_LABEL || instr->op == IR_GOTO || instr->op == IR_RETURN ||
+        (instr->op == IR_POP && instr->arg == SEGMENT_POINTER && instr->operand == 1)) {
+      known = false;
+    } else if (known && clobbers(instr, &base)) {
+      known = false;
+    }
+  }
+  return changes;
+}
+
+int fold_array_offsets(PassContext *ctx) {
+  return fold_offsets(ctx) + reuse_bases(ctx);
+}
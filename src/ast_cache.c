@@ -0,0 +1,328 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ast_cache.h"
+
+#define AST_CACHE_VERSION 2
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t layout;
+  uint64_t sourceHash;
+  uint64_t root;
+  uint64_t relocs;
+  uint64_t nRelocs;
+  uint64_t size;
+} AstCacheHeader;
+
+// the image under construction; nodes are addressed by their offset since the
+// buffer moves while it grows
+typedef struct {
+  char *data;
+  size_t len;
+  size_t capacity;
+  Vector *relocs;
+} Image;
+
+typedef size_t (*PutElem)(Image *img, void *elem);
+
+static size_t put_class(Image *img, Class *class);
+static size_t put_statement(Image *img, void *elem);
+static size_t put_expression(Image *img, void *elem);
+static size_t put_term(Image *img, Term *term);
+
+// the image is only valid for a binary with the same structure layout
+static uint64_t layout_fingerprint(void) {
+  size_t sizes[] = {
+      sizeof(void *), sizeof(Vector), sizeof(Map), sizeof(SymbolTable), sizeof(Properties),
+      sizeof(Class), sizeof(Function), sizeof(Statement), sizeof(LetStmt), sizeof(IfStmt),
+      sizeof(WhileStmt), sizeof(DoStmt), sizeof(ReturnStmt), sizeof(Expression), sizeof(Term),
+      sizeof(TermPair), sizeof(SubroutineCall), sizeof(ExpressionList), sizeof(Array)
+  };
+  return hash_bytes((char *) sizes, sizeof(sizes));
+}
+
+/*============================ Writing ============================ */
+
+static size_t put(Image *img, void *src, size_t size) {
+  size_t offset = (img->len + 7) & ~(size_t) 7;
+  while (offset + size > img->capacity) {
+    img->capacity *= 2;
+    img->data = realloc(img->data, img->capacity);
+  }
+  memset(img->data + img->len, 0, offset - img->len);
+  if (src != NULL) {
+    memcpy(img->data + offset, src, size);
+  } else {
+    memset(img->data + offset, 0, size);
+  }
+  img->len = offset + size;
+  return offset;
+}
+
+// stores the offset of a node in the pointer field at fieldOffset
+static void put_link(Image *img, size_t fieldOffset, size_t target) {
+  uint64_t value = target;
+  memcpy(img->data + fieldOffset, &value, sizeof(value));
+  if (target != 0) {
+    vec_push(img->relocs, (void *) (uintptr_t) fieldOffset);
+  }
+}
+
+static size_t put_string(Image *img, char *str) {
+  if (str == NULL) return 0;
+  return put(img, str, strlen(str) + 1);
+}
+
+static size_t put_vector(Image *img, Vector *vector, PutElem putElem) {
+  if (vector == NULL) return 0;
+
+  Vector copy = *vector;
+  copy.capacity = vector->len > 0 ? vector->len : 1;
+  size_t offset = put(img, &copy, sizeof(Vector));
+  size_t data = put(img, NULL, sizeof(void *) * copy.capacity);
+  put_link(img, offset + offsetof(Vector, data), data);
+
+  for (int i = 0; i < vector->len; i++) {
+    put_link(img, data + i * sizeof(void *), putElem(img, vec_get(vector, i)));
+  }
+  return offset;
+}
+
+static size_t put_string_elem(Image *img, void *elem) {
+  return put_string(img, elem);
+}
+
+static size_t put_properties(Image *img, void *elem) {
+  Properties *props = elem;
+  size_t offset = put(img, props, sizeof(Properties));
+  put_link(img, offset + offsetof(Properties, type), put_string(img, props->type));
+  return offset;
+}
+
+static size_t put_symbol_table(Image *img, SymbolTable *table) {
+  size_t offset = put(img, table, sizeof(SymbolTable));
+  size_t map = put(img, table->table, sizeof(Map));
+  put_link(img, offset + offsetof(SymbolTable, table), map);
+  put_link(img, map + offsetof(Map, keys), put_vector(img, table->table->keys, put_string_elem));
+  put_link(img, map + offsetof(Map, vals), put_vector(img, table->table->vals, put_properties));
+  return offset;
+}
+
+static size_t put_expression_list(Image *img, ExpressionList *list) {
+  if (list == NULL) return 0;
+  size_t offset = put(img, list, sizeof(ExpressionList));
+  put_link(img, offset + offsetof(ExpressionList, expressions), put_vector(img, list->expressions, put_expression));
+  return offset;
+}
+
+static size_t put_subroutine_call(Image *img, SubroutineCall *call) {
+  size_t offset = put(img, call, sizeof(SubroutineCall));
+  put_link(img, offset + offsetof(SubroutineCall, target),
+       call->type == TARGET_SUB_CALL ? put_string(img, call->target) : 0);
+  put_link(img, offset + offsetof(SubroutineCall, subroutineName), put_string(img, call->subroutineName));
+  put_link(img, offset + offsetof(SubroutineCall, exprList), put_expression_list(img, call->exprList));
+  return offset;
+}
+
+static size_t put_term_pair(Image *img, void *elem) {
+  TermPair *pair = elem;
+  size_t offset = put(img, pair, sizeof(TermPair));
+  put_link(img, offset + offsetof(TermPair, term), put_term(img, pair->term));
+  return offset;
+}
+
+static size_t put_term(Image *img, Term *term) {
+  size_t offset = put(img, term, sizeof(Term));
+  size_t field = offset + offsetof(Term, str);
+
+  switch (term->type) {
+    case TERM_INT:
+    case TERM_STR:
+    case TERM_VAR:
+      // integer, str and varName share the same union slot
+      put_link(img, field, put_string(img, term->str));
+      break;
+    case TERM_KEYWORD:
+      break;
+    case TERM_ARRAY: {
+      size_t array = put(img, term->array, sizeof(Array));
+      put_link(img, array + offsetof(Array, varName), put_string(img, term->array->varName));
+      put_link(img, array + offsetof(Array, expr), put_expression(img, term->array->expr));
+      put_link(img, field, array);
+      break;
+    }
+    case TERM_SUB_CALL:
+      put_link(img, field, put_subroutine_call(img, term->subCall));
+      break;
+    case TERM_EXPR_PARENS:
+      put_link(img, field, put_expression(img, term->expr));
+      break;
+    case TERM_TERM_PAIR:
+      put_link(img, field, put_term_pair(img, term->termPair));
+      break;
+  }
+  return offset;
+}
+
+static size_t put_expression(Image *img, void *elem) {
+  Expression *expr = elem;
+  if (expr == NULL) return 0;
+  size_t offset = put(img, expr, sizeof(Expression));
+  put_link(img, offset + offsetof(Expression, firstTerm), put_term(img, expr->firstTerm));
+  put_link(img, offset + offsetof(Expression, termPairs), put_vector(img, expr->termPairs, put_term_pair));
+  return offset;
+}
+
+static size_t put_statements(Image *img, Vector *stmts) {
+  return put_vector(img, stmts, put_statement);
+}
+
+static size_t put_statement(Image *img, void *elem) {
+  Statement *stmt = elem;
+  size_t offset = put(img, stmt, sizeof(Statement));
+  size_t field = offset + offsetof(Statement, retStmt);
+
+  switch (stmt->type) {
+    case RETURN_STMT: {
+      size_t node = put(img, stmt->retStmt, sizeof(ReturnStmt));
+      put_link(img, node + offsetof(ReturnStmt, expr), put_expression(img, stmt->retStmt->expr));
+      put_link(img, field, node);
+      break;
+    }
+    case WHILE_STMT: {
+      size_t node = put(img, stmt->whileStmt, sizeof(WhileStmt));
+      put_link(img, node + offsetof(WhileStmt, expr), put_expression(img, stmt->whileStmt->expr));
+      put_link(img, node + offsetof(WhileStmt, stmts), put_statements(img, stmt->whileStmt->stmts));
+      put_link(img, field, node);
+      break;
+    }
+    case IF_STMT: {
+      size_t node = put(img, stmt->ifStmt, sizeof(IfStmt));
+      put_link(img, node + offsetof(IfStmt, expr), put_expression(img, stmt->ifStmt->expr));
+      put_link(img, node + offsetof(IfStmt, ifStmts), put_statements(img, stmt->ifStmt->ifStmts));
+      put_link(img, node + offsetof(IfStmt, elseStmts), put_statements(img, stmt->ifStmt->elseStmts));
+      put_link(img, field, node);
+      break;
+    }
+    case DO_STMT: {
+      size_t node = put(img, stmt->doStmt, sizeof(DoStmt));
+      put_link(img, node + offsetof(DoStmt, call), put_subroutine_call(img, stmt->doStmt->call));
+      put_link(img, field, node);
+      break;
+    }
+    case LET_STMT: {
+      size_t node = put(img, stmt->letStmt, sizeof(LetStmt));
+      put_link(img, node + offsetof(LetStmt, name), put_string(img, stmt->letStmt->name));
+      put_link(img, node + offsetof(LetStmt, firstExpr), put_expression(img, stmt->letStmt->firstExpr));
+      put_link(img, node + offsetof(LetStmt, secondExpr), put_expression(img, stmt->letStmt->secondExpr));
+      put_link(img, field, node);
+      break;
+    }
+  }
+  return offset;
+}
+
+static size_t put_function(Image *img, void *elem) {
+  Function *func = elem;
+  size_t offset = put(img, func, sizeof(Function));
+  put_link(img, offset + offsetof(Function, name), put_string(img, func->name));
+  put_link(img, offset + offsetof(Function, returnType), put_string(img, func->returnType));
+  put_link(img, offset + offsetof(Function, lTable), put_symbol_table(img, func->lTable));
+  put_link(img, offset + offsetof(Function, statements), put_statements(img, func->statements));
+  return offset;
+}
+
+static size_t put_class(Image *img, Class *class) {
+  size_t offset = put(img, class, sizeof(Class));
+  put_link(img, offset + offsetof(Class, name), put_string(img, class->name));
+  put_link(img, offset + offsetof(Class, gTable), put_symbol_table(img, class->gTable));
+  put_link(img, offset + offsetof(Class, functions), put_vector(img, class->functions, put_function));
+  return offset;
+}
+
+char *serialize_ast(Class *class, uint64_t sourceHash, size_t *len) {
+  Image img;
+  img.capacity = 4096;
+  img.data = malloc(img.capacity);
+  img.len = 0;
+  img.relocs = new_vec();
+
+  size_t header = put(&img, NULL, sizeof(AstCacheHeader));
+  size_t root = put_class(&img, class);
+
+  size_t relocs = put(&img, NULL, sizeof(uint64_t) * img.relocs->len);
+  for (int i = 0; i < img.relocs->len; i++) {
+    uint64_t reloc = (uintptr_t) vec_get(img.relocs, i);
+    memcpy(img.data + relocs + i * sizeof(uint64_t), &reloc, sizeof(reloc));
+  }
+
+  AstCacheHeader *hdr = (AstCacheHeader *) (img.data + header);
+  memcpy(hdr->magic, "JAST", 4);
+  hdr->version = AST_CACHE_VERSION;
+  hdr->layout = layout_fingerprint();
+  hdr->sourceHash = sourceHash;
+  hdr->root = root;
+  hdr->relocs = relocs;
+  hdr->nRelocs = img.relocs->len;
+  hdr->size = img.len;
+
+  free(img.relocs->data);
+  free(img.relocs);
+  *len = img.len;
+  return img.data;
+}
+
+/*============================ Loading ============================ */
+
+// returns NULL when there is no usable image for this exact source
+Class *load_ast_cache(char *path, uint64_t sourceHash) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size < (off_t) sizeof(AstCacheHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = statbuf.st_size;
+  char *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) return NULL;
+
+  AstCacheHeader *hdr = (AstCacheHeader *) base;
+  bool valid = !memcmp(hdr->magic, "JAST", 4) && hdr->version == AST_CACHE_VERSION
+               && hdr->layout == layout_fingerprint() && hdr->sourceHash == sourceHash
+               && hdr->size == size && hdr->root < size
+               && hdr->relocs <= size && hdr->nRelocs <= (size - hdr->relocs) / sizeof(uint64_t);
+  if (!valid) {
+    munmap(base, size);
+    return NULL;
+  }
+
+  uint64_t *relocs = (uint64_t *) (base + hdr->relocs);
+  for (uint64_t i = 0; i < hdr->nRelocs; i++) {
+    if (relocs[i] > size - sizeof(uintptr_t)) {
+      munmap(base, size);
+      return NULL;
+    }
+    uintptr_t *field = (uintptr_t *) (base + relocs[i]);
+    *field += (uintptr_t) base;
+  }
+
+  return (Class *) (base + hdr->root);
+}
+
+char *ast_cache_path(char *cacheDir, char *className) {
+  StringBuilder *sb = new_sb();
+  sb_concat_strings(sb, 4, cacheDir, "/", className, ".jast");
+  char *path = sb_get(sb);
+  free(sb);
+  return path;
+}
@@ -0,0 +1,17 @@
+
+#ifndef COMPILER_AST_CACHE_H
+#define COMPILER_AST_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "parser.h"
+
+// A parsed class (AST and symbol tables) stored as an image of the in-memory
+// structures: every pointer is saved as an offset into the file together with
+// a relocation table. Loading maps the file and rebases the pointers in place,
+// so a warm build goes straight from the source hash check to code generation.
+char *serialize_ast(Class *class, uint64_t sourceHash, size_t *len);
+Class *load_ast_cache(char *path, uint64_t sourceHash);
+char *ast_cache_path(char *cacheDir, char *className);
+
+#endif //COMPILER_AST_CACHE_H
@@ -0,0 +1,247 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+#include <sys/stat.h>
+#include "build.h"
+#include "io_batch.h"
+#include "ast_cache.h"
+#include "vm_binary.h"
+#include "call_graph.h"
+#include "inliner.h"
+
+static char *get_basename_without_ext(char *path) {
+  char *baseName = basename(path);
+  char *nameWithoutExtension = sb_get((StringBuilder *) vec_get(split_by(baseName, '.'), 0));
+  return nameWithoutExtension;
+}
+
+// with an AST cache the class is only lexed and parsed when no image of
+// the same source exists
+static Class *parse_source(CompiledClass *compiled, char *className, char *source, size_t len, Options *options) {
+  compiled->tokenizer = NULL;
+  compiled->cachePath = NULL;
+  compiled->cacheImage = NULL;
+  compiled->cacheLen = 0;
+
+  if (options->astCacheDir != NULL) {
+    compiled->cachePath = ast_cache_path(options->astCacheDir, className);
+    Class *class = load_ast_cache(compiled->cachePath, compiled->sourceHash);
+    if (class != NULL) return class;
+  }
+
+  compiled->tokenizer = new_tokenizer_from_buffer(source, len);
+  Class *class = build_ast(compiled->tokenizer);
+
+  if (compiled->cachePath != NULL) {
+    compiled->cacheImage = serialize_ast(class, compiled->sourceHash, &compiled->cacheLen);
+  }
+  return class;
+}
+
+static CompiledClass *parse_class(char *path, char *source, size_t len, Options *options) {
+  CompiledClass *compiled = malloc(sizeof(CompiledClass));
+  compiled->path = path;
+  compiled->sourceHash = hash_bytes(source, len);
+  compiled->ast = parse_source(compiled, get_basename_without_ext(path), source, len, options);
+  return compiled;
+}
+
+// the generated code is left in compiled->engine->writer; funcCache holds
+// the subroutines of the previous compilation of the class (watch mode),
+// otherwise they are taken from the cache directory if there is one
+static void generate_class(CompiledClass *compiled, Options *options, FuncCache *funcCache,
+                           SignatureIndex *signatures, InlineTable *inlines) {
+  char *className = get_basename_without_ext(compiled->path);
+  compiled->funcCachePath = NULL;
+  compiled->funcCacheImage = NULL;
+  compiled->funcCacheLen = 0;
+  // cached subroutines skip the passes, which would leave their remarks out
+  if (remarks_requested(options->passes)) {
+    funcCache = NULL;
+  } else if (funcCache == NULL && options->astCacheDir != NULL) {
+    compiled->funcCachePath = func_cache_path(options->astCacheDir, className);
+    funcCache = load_func_cache(compiled->funcCachePath);
+  }
+  compiled->funcCache = funcCache;
+
+  VMwriter *writer;
+  if (options->emit == EMIT_NULL) {
+    writer = new_null_writer();
+  } else if (options->emit == EMIT_VMB) {
+    writer = init_binary_vmWriter(className);
+  } else {
+    writer = init_vmWriter(className);
+  }
+  compiled->engine = new_engine(writer, compiled->ast);
+  compiled->engine->jobs = options->jobs;
+  compiled->engine->funcCache = funcCache;
+  compiled->engine->passes = options->passes;
+  compiled->engine->signatures = signatures;
+  compiled->engine->poolLimit = options->poolStringsLimit;
+  compiled->engine->nonRetaining = options->nonRetaining;
+  compiled->engine->inlines = inlines;
+  // subroutines are checked against the other classes, so cached code is
+  // only reused while every header stays the same
+  compiled->engine->config = pass_config(options->passes) ^ (signatures != NULL ? signatures->hash : 0) ^ options->emit;
+  for (int i = 0; i < options->nonRetaining->len; i++) {
+    char *callee = vec_get(options->nonRetaining, i);
+    compiled->engine->config ^= hash_bytes(callee, strlen(callee)) * 31;
+  }
+  if (inlines != NULL) {
+    compiled->engine->config ^= inlines->hash;
+  }
+  compile_file(compiled->engine);
+  finish_vmWriter(compiled->engine->writer);
+
+  if (funcCache != NULL) {
+    func_cache_prune(funcCache);
+  }
+  if (compiled->funcCachePath != NULL) {
+    compiled->funcCacheImage = serialize_func_cache(funcCache, &compiled->funcCacheLen);
+  }
+}
+
+CompiledClass *compile_source(char *path, char *source, size_t len, Options *options, FuncCache *funcCache,
+                              SignatureIndex *signatures) {
+  CompiledClass *compiled = parse_class(path, source, len, options);
+  generate_class(compiled, options, funcCache, signatures, NULL);
+  return compiled;
+}
+
+// the headers of all classes, mapped from the cache directory when it holds
+// an index of the very same sources
+static SignatureIndex *index_signatures(char **sources, size_t *lens, int n, Options *options, IOBatch *batch) {
+  if (options->astCacheDir == NULL) {
+    return scan_signatures(sources, lens, n, options->jobs);
+  }
+
+  char *path = signature_index_path(options->astCacheDir);
+  SignatureIndex *index = load_signature_index(path, hash_sources(sources, lens, n));
+  if (index == NULL) {
+    index = scan_signatures(sources, lens, n, options->jobs);
+    io_batch_write(batch, path, index->image, index->len);
+  }
+  return index;
+}
+
+/*==== Whole program ====*/
+
+// the code the removed subroutines of a class would have taken
+static void measure_removed(CompiledClass *compiled, Vector *removed, Options *options, long *bytes, long *commands) {
+  Class dead = *compiled->ast;
+  dead.functions = removed;
+
+  CompilationEngine measure = *compiled->engine;
+  measure.ast = &dead;
+  measure.writer = fork_vmWriter(compiled->engine->writer);
+  measure.funcCache = NULL;
+  measure.jobs = 1;
+  // the removed subroutines have nothing to remark on
+  if (remarks_requested(options->passes)) measure.passes = NULL;
+  compile_file(&measure);
+  finish_vmWriter(measure.writer);
+
+  *bytes = (long) measure.writer->len;
+  *commands = measure.writer->nCommands;
+  free(measure.writer->data);
+  free(measure.writer);
+}
+
+// drops every subroutine that cannot be reached from the roots, generates
+// the classes with calls inlined across them and reports what was left out
+// of each
+static void build_whole_program(CompiledClass **compiled, int n, Options *options, SignatureIndex *signatures) {
+  Class **classes = malloc(sizeof(Class *) * n);
+  for (int i = 0; i < n; i++) {
+    classes[i] = compiled[i]->ast;
+  }
+  CallGraph *graph = new_call_graph(classes, n);
+  mark_reachable(graph, options->roots);
+
+  Vector **removed = malloc(sizeof(Vector *) * n);
+  for (int i = 0; i < n; i++) {
+    removed[i] = remove_unreachable(graph, i);
+  }
+  InlineTable *inlines = NULL;
+  if (pass_enabled(options->passes, "inline")) {
+    inlines = new_inline_table(graph, signatures, options->inlineLimit);
+  }
+
+  fprintf(stderr, "===== unreachable subroutines =====\n");
+  fprintf(stderr, "%-20s %8s %10s %10s\n", "class", "removed", "bytes", "commands");
+  long totalBytes = 0, totalCommands = 0, totalRemoved = 0;
+  for (int i = 0; i < n; i++) {
+    generate_class(compiled[i], options, NULL, signatures, inlines);
+    if (removed[i]->len == 0) continue;
+
+    long bytes, commands;
+    measure_removed(compiled[i], removed[i], options, &bytes, &commands);
+    fprintf(stderr, "%-20s %8i %10ld %10ld\n", classes[i]->name, removed[i]->len, bytes, commands);
+    totalRemoved += removed[i]->len;
+    totalBytes += bytes;
+    totalCommands += commands;
+  }
+  fprintf(stderr, "%-20s %8ld %10ld %10ld\n", "total", totalRemoved, totalBytes, totalCommands);
+  free(removed);
+  free(classes);
+}
+
+// every read is submitted up front; the header scan needs all of them, after
+// which the classes are compiled one by one
+Vector *build_files(Vector *paths, Options *options) {
+  Vector *classes = new_vec();
+  IOBatch *batch = new_io_batch();
+
+  if (options->astCacheDir != NULL) {
+    mkdir(options->astCacheDir, 0755);
+  }
+
+  for (int i = 0; i < paths->len; i++) {
+    io_batch_read(batch, vec_get(paths, i));
+  }
+
+  char **sources = malloc(sizeof(char *) * paths->len);
+  size_t *lens = malloc(sizeof(size_t) * paths->len);
+  for (int i = 0; i < paths->len; i++) {
+    sources[i] = io_batch_wait_read(batch, i, &lens[i]);
+
+    if (sources[i] == NULL) {
+      xprintf("could not read %s\n", (char *) vec_get(paths, i));
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  SignatureIndex *signatures = index_signatures(sources, lens, paths->len, options, batch);
+
+  CompiledClass **program = NULL;
+  if (options->wholeProgram) {
+    program = malloc(sizeof(CompiledClass *) * paths->len);
+    for (int i = 0; i < paths->len; i++) {
+      program[i] = parse_class(vec_get(paths, i), sources[i], lens[i], options);
+    }
+    build_whole_program(program, paths->len, options, signatures);
+  }
+
+  for (int i = 0; i < paths->len; i++) {
+    char *path = vec_get(paths, i);
+    CompiledClass *compiled = program != NULL ? program[i]
+                                              : compile_source(path, sources[i], lens[i], options, NULL, signatures);
+    VMwriter *writer = compiled->engine->writer;
+    if (writer->outPath != NULL) {
+      io_batch_write(batch, writer->outPath, writer->data, writer->len);
+    }
+    if (compiled->cacheImage != NULL) {
+      io_batch_write(batch, compiled->cachePath, compiled->cacheImage, compiled->cacheLen);
+    }
+    if (compiled->funcCacheImage != NULL) {
+      io_batch_write(batch, compiled->funcCachePath, compiled->funcCacheImage, compiled->funcCacheLen);
+    }
+    vec_push(classes, compiled);
+  }
+
+  if (!io_batch_finish(batch)) {
+    exit(EXIT_FAILURE);
+  }
+  return classes;
+}
@@ -0,0 +1,34 @@
+
+#ifndef COMPILER_BUILD_H
+#define COMPILER_BUILD_H
+
+#include <stdint.h>
+#include "util.h"
+#include "lexer.h"
+#include "parser.h"
+#include "compilation_engine.h"
+#include "options.h"
+#include "signature_index.h"
+
+// everything that is kept for a class after it has been compiled
+typedef struct {
+  char *path;
+  uint64_t sourceHash;
+  Tokenizer *tokenizer;
+  Class *ast;
+  CompilationEngine *engine;
+  // a fresh AST cache image that still has to be written to cachePath
+  char *cachePath;
+  char *cacheImage;
+  size_t cacheLen;
+  FuncCache *funcCache;
+  char *funcCachePath;
+  char *funcCacheImage;
+  size_t funcCacheLen;
+} CompiledClass;
+
+CompiledClass *compile_source(char *path, char *source, size_t len, Options *options, FuncCache *funcCache,
+                              SignatureIndex *signatures);
+Vector *build_files(Vector *paths, Options *options);
+
+#endif //COMPILER_BUILD_H
@@ -0,0 +1,212 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "call_graph.h"
+
+// subroutines of the OS the code generator calls on its own; they are roots
+// when the program brings its own OS classes
+static char *IMPLICIT_ROOTS[] = {
+    "Math.multiply", "Math.divide", "Memory.alloc", "String.new", "String.appendChar", "String.dispose"
+};
+
+#define N_IMPLICIT_ROOTS ((int) (sizeof(IMPLICIT_ROOTS) / sizeof(IMPLICIT_ROOTS[0])))
+
+static char *function_key(char *className, char *name) {
+  StringBuilder *sb = new_sb();
+  sb_concat_strings(sb, 3, className, ".", name);
+  return sb_get(sb);
+}
+
+static int compare_keys(const void *a, const void *b) {
+  return strcmp(*(char **) a, *(char **) b);
+}
+
+CallGraph *new_call_graph(Class **classes, int n) {
+  CallGraph *graph = malloc(sizeof(CallGraph));
+  graph->classes = classes;
+  graph->nClasses = n;
+  graph->first = malloc(sizeof(int) * (n + 1));
+  graph->nFuncs = 0;
+  for (int c = 0; c < n; c++) {
+    graph->first[c] = graph->nFuncs;
+    graph->nFuncs += classes[c]->functions->len;
+  }
+  graph->first[n] = graph->nFuncs;
+
+  graph->funcs = malloc(sizeof(Function *) * graph->nFuncs);
+  char **keys = malloc(sizeof(char *) * graph->nFuncs * 2);
+  for (int c = 0; c < n; c++) {
+    for (int i = 0; i < classes[c]->functions->len; i++) {
+      int f = graph->first[c] + i;
+      graph->funcs[f] = vec_get(classes[c]->functions, i);
+      // the index rides along in the slot after the key while sorting
+      keys[2 * f] = function_key(classes[c]->name, graph->funcs[f]->name);
+      keys[2 * f + 1] = (char *) (intptr_t) f;
+    }
+  }
+  qsort(keys, graph->nFuncs, sizeof(char *) * 2, compare_keys);
+
+  graph->keys = malloc(sizeof(char *) * graph->nFuncs);
+  graph->keyFunc = malloc(sizeof(int) * graph->nFuncs);
+  for (int i = 0; i < graph->nFuncs; i++) {
+    graph->keys[i] = keys[2 * i];
+    graph->keyFunc[i] = (int) (intptr_t) keys[2 * i + 1];
+  }
+  free(keys);
+
+  graph->reachable = calloc(graph->nFuncs, sizeof(bool));
+  return graph;
+}
+
+// index of Class.name in funcs, -1 if it is not part of the program
+static int find_function(CallGraph *graph, char *key) {
+  char **found = bsearch(&key, graph->keys, graph->nFuncs, sizeof(char *), compare_keys);
+  return found != NULL ? graph->keyFunc[found - graph->keys] : -1;
+}
+
+int find_subroutine(CallGraph *graph, char *className, char *name) {
+  char *key = function_key(className, name);
+  int f = find_function(graph, key);
+  free(key);
+  return f;
+}
+
+/*============================ Walk ============================ */
+
+typedef struct {
+  CallGraph *graph;
+  Class *class;
+  Function *func;
+  // functions found reachable whose calls have not been followed yet
+  int *work;
+  int nWork;
+} Walk;
+
+static void walk_expression(Walk *walk, Expression *expr);
+
+static void reach(Walk *walk, char *className, char *name) {
+  int f = find_subroutine(walk->graph, className, name);
+  if (f >= 0 && !walk->graph->reachable[f]) {
+    walk->graph->reachable[f] = true;
+    walk->work[walk->nWork++] = f;
+  }
+}
+
+// the class a call goes to: the type of a variable target, the target
+// itself when it names a class, and the current class without a target
+static char *target_class(Walk *walk, SubroutineCall *call) {
+  if (call->type == PLAIN_SUB_CALL) return walk->class->name;
+  char *type = typeOf(walk->func->lTable, call->target);
+  if (type == NULL) type = typeOf(walk->class->gTable, call->target);
+  return type != NULL ? type : call->target;
+}
+
+static void walk_call(Walk *walk, SubroutineCall *call) {
+  reach(walk, target_class(walk, call), call->subroutineName);
+  for (int i = 0; call->exprList != NULL && i < call->exprList->expressions->len; i++) {
+    walk_expression(walk, vec_get(call->exprList->expressions, i));
+  }
+}
+
+static void walk_term(Walk *walk, Term *term) {
+  switch (term->type) {
+    case TERM_ARRAY:
+      walk_expression(walk, term->array->expr);
+      break;
+    case TERM_SUB_CALL:
+      walk_call(walk, term->subCall);
+      break;
+    case TERM_EXPR_PARENS:
+      walk_expression(walk, term->expr);
+      break;
+    case TERM_TERM_PAIR:
+      walk_term(walk, term->termPair->term);
+      break;
+    default:
+      break;
+  }
+}
+
+static void walk_expression(Walk *walk, Expression *expr) {
+  if (expr == NULL) return;
+  walk_term(walk, expr->firstTerm);
+  for (int i = 0; expr->termPairs != NULL && i < expr->termPairs->len; i++) {
+    TermPair *pair = vec_get(expr->termPairs, i);
+    walk_term(walk, pair->term);
+  }
+}
+
+static void walk_statements(Walk *walk, Vector *stmts) {
+  for (int i = 0; stmts != NULL && i < stmts->len; i++) {
+    Statement *stmt = vec_get(stmts, i);
+    switch (stmt->type) {
+      case LET_STMT:
+        walk_expression(walk, stmt->letStmt->firstExpr);
+        walk_expression(walk, stmt->letStmt->secondExpr);
+        break;
+      case IF_STMT:
+        walk_expression(walk, stmt->ifStmt->expr);
+        walk_statements(walk, stmt->ifStmt->ifStmts);
+        walk_statements(walk, stmt->ifStmt->elseStmts);
+        break;
+      case WHILE_STMT:
+        walk_expression(walk, stmt->whileStmt->expr);
+        walk_statements(walk, stmt->whileStmt->stmts);
+        break;
+      case RETURN_STMT:
+        walk_expression(walk, stmt->retStmt->expr);
+        break;
+      case DO_STMT:
+        walk_call(walk, stmt->doStmt->call);
+        break;
+    }
+  }
+}
+
+static int class_of(CallGraph *graph, int f) {
+  int c = 0;
+  while (graph->first[c + 1] <= f) c++;
+  return c;
+}
+
+// roots holds "Class.name" strings; names that are not part of the program
+// are ignored
+void mark_reachable(CallGraph *graph, Vector *roots) {
+  Walk walk = {graph, NULL, NULL, malloc(sizeof(int) * graph->nFuncs), 0};
+
+  for (int i = 0; i < roots->len + N_IMPLICIT_ROOTS; i++) {
+    char *root = i < roots->len ? vec_get(roots, i) : IMPLICIT_ROOTS[i - roots->len];
+    int f = find_function(graph, root);
+    if (f >= 0 && !graph->reachable[f]) {
+      graph->reachable[f] = true;
+      walk.work[walk.nWork++] = f;
+    }
+  }
+
+  while (walk.nWork > 0) {
+    int f = walk.work[--walk.nWork];
+    walk.class = graph->classes[class_of(graph, f)];
+    walk.func = graph->funcs[f];
+    walk_statements(&walk, walk.func->statements);
+  }
+  free(walk.work);
+}
+
+// drops the unreachable subroutines from the class in place and returns them
+Vector *remove_unreachable(CallGraph *graph, int class) {
+  Vector *funcs = graph->classes[class]->functions;
+  Vector *removed = new_vec();
+  int kept = 0;
+
+  for (int i = 0; i < funcs->len; i++) {
+    Function *func = funcs->data[i];
+    if (graph->reachable[graph->first[class] + i]) {
+      // vectors of a mapped AST must not grow, but may be rewritten in place
+      funcs->data[kept++] = func;
+    } else {
+      vec_push(removed, func);
+    }
+  }
+  funcs->len = kept;
+  return removed;
+}
@@ -0,0 +1,28 @@
+
+#ifndef COMPILER_CALL_GRAPH_H
+#define COMPILER_CALL_GRAPH_H
+
+#include "util.h"
+#include "parser.h"
+
+// The subroutines of a whole program and the calls between them, taken from
+// the SubroutineCall nodes of every class.
+typedef struct {
+  Class **classes;
+  int nClasses;
+  // Function* of every class, flattened; first[c] is the first of class c
+  Function **funcs;
+  int *first;
+  int nFuncs;
+  // "Class.name" of every subroutine, sorted, with its index in funcs
+  char **keys;
+  int *keyFunc;
+  bool *reachable;
+} CallGraph;
+
+CallGraph *new_call_graph(Class **classes, int n);
+int find_subroutine(CallGraph *graph, char *className, char *name);
+void mark_reachable(CallGraph *graph, Vector *roots);
+Vector *remove_unreachable(CallGraph *graph, int class);
+
+#endif //COMPILER_CALL_GRAPH_H
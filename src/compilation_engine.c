@@ -3,16 +3,29 @@
 #include <zconf.h>
 #include <ctype.h>
 #include <string.h>
+#include <pthread.h>
 #include "compilation_engine.h"
 #include "lexer.h"
 
 
-CompilationEngine *new_engine(char *fileName, Class *class) {
+CompilationEngine *new_engine(VMwriter *writer, Class *class) {
   CompilationEngine *engine = malloc(sizeof(CompilationEngine));
-  engine->writer = init_vmWriter(fileName);
+  engine->writer = writer;
   engine->ast = class;
   engine->curFunc = NULL;
   engine->labelCounter = 0;
+  engine->jobs = 1;
+  engine->funcCache = NULL;
+  engine->passes = NULL;
+  engine->signatures = NULL;
+  engine->curLine = 0;
+  engine->config = 0;
+  engine->strings = NULL;
+  engine->poolLimit = HACK_STATIC_SLOTS;
+  engine->nonRetaining = NULL;
+  engine->extraLocals = 0;
+  engine->liveExtraLocals = 0;
+  engine->inlines = NULL;
   return engine;
 }
 
@@ -20,6 +33,8 @@ CompilationEngine *new_engine(char *fileName, Class *class) {
 
 static void compile_subroutine(CompilationEngine *engine, Function *func);
 static void compile_expression(CompilationEngine *engine, Expression *expr);
+static void compile_expression_until(CompilationEngine *engine, Expression *expr, int nPairs);
+static void compile_string(CompilationEngine *engine, char *str);
 static void compile_subroutineCall(CompilationEngine *engine, SubroutineCall *call);
 static void compile_term(CompilationEngine *engine, Term *term);
 static void compile_statement(CompilationEngine *engine, Statement *stmt);
@@ -38,21 +53,254 @@ static Kind find_kind(CompilationEngine *engine, char *identName);
 static char *find_type(CompilationEngine *engine, char *identName);
 static void alloc_mem(CompilationEngine *engine, int nwords);
 
-void compile_file(CompilationEngine *engine) {
+// below this many subroutines starting threads costs more than it saves
+#define MIN_PARALLEL_FUNCTIONS 16
+
+typedef struct {
+  CompilationEngine *engine;
+  VMwriter **parts;
+  int next;
+  bool failed;
+  pthread_mutex_t lock;
+} ParallelJob;
+
+static void *compile_worker(void *arg) {
+  ParallelJob *job = arg;
+  Vector *funcs = job->engine->ast->functions;
+
+  jmp_buf trap;
+  if (setjmp(trap)) {
+    set_error_trap(NULL);
+    pthread_mutex_lock(&job->lock);
+    job->failed = true;
+    pthread_mutex_unlock(&job->lock);
+    return NULL;
+  }
+  set_error_trap(&trap);
+
+  while (true) {
+    pthread_mutex_lock(&job->lock);
+    int i = job->failed ? funcs->len : job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= funcs->len) break;
+    if (job->parts[i] != NULL) continue;
+
+    // labels are numbered per subroutine, so a private engine per
+    // subroutine produces exactly what the sequential build would
+    CompilationEngine worker = *job->engine;
+    worker.writer = fork_vmWriter(job->engine->writer);
+    compile_subroutine(&worker, vec_get(funcs, i));
+    job->parts[i] = worker.writer;
+  }
+
+  set_error_trap(NULL);
+  return NULL;
+}
+
+// fills in the parts that are still NULL
+static void compile_parts(CompilationEngine *engine, VMwriter **parts) {
+  Vector *funcs = engine->ast->functions;
+
+  if (engine->jobs <= 1 || funcs->len < MIN_PARALLEL_FUNCTIONS) {
+    for (int i = 0; i < funcs->len; i++) {
+      if (parts[i] != NULL) continue;
+      CompilationEngine worker = *engine;
+      worker.writer = fork_vmWriter(engine->writer);
+      compile_subroutine(&worker, vec_get(funcs, i));
+      parts[i] = worker.writer;
+    }
+    return;
+  }
+
+  ParallelJob job;
+  job.engine = engine;
+  job.parts = parts;
+  job.next = 0;
+  job.failed = false;
+  pthread_mutex_init(&job.lock, NULL);
+
+  int nThreads = engine->jobs < funcs->len ? engine->jobs : funcs->len;
+  pthread_t threads[nThreads];
+  for (int i = 0; i < nThreads; i++) {
+    pthread_create(&threads[i], NULL, compile_worker, &job);
+  }
+  for (int i = 0; i < nThreads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  pthread_mutex_destroy(&job.lock);
+
+  if (job.failed) {
+    abort_compilation();
+  }
+}
+
+static void compile_functions(CompilationEngine *engine) {
   Class *class = engine->ast;
   Vector *funcs = class->functions;
+  FuncCache *cache = engine->funcCache;
+
+  if (cache == NULL && (engine->jobs <= 1 || funcs->len < MIN_PARALLEL_FUNCTIONS)) {
+    for (int i = 0; i < funcs->len; i++) {
+      Function *func = vec_get(funcs, i);
+      compile_subroutine(engine, func);
+    }
+    return;
+  }
+
+  VMwriter **parts = calloc(funcs->len, sizeof(VMwriter *));
+  uint64_t *keys = calloc(funcs->len, sizeof(uint64_t));
+
+  for (int i = 0; cache != NULL && i < funcs->len; i++) {
+    keys[i] = function_key(class, vec_get(funcs, i), engine->config);
+    FuncCacheEntry *entry = func_cache_get(cache, keys[i]);
+    if (entry != NULL) {
+      parts[i] = fork_vmWriter(engine->writer);
+      append_raw_vmWriter(parts[i], entry->data, entry->len, entry->nCommands);
+    }
+  }
 
+  compile_parts(engine, parts);
+
+  // concatenated in declaration order
   for (int i = 0; i < funcs->len; i++) {
-    Function *func = vec_get(funcs, i);
-    compile_subroutine(engine, func);
+    append_vmWriter(engine->writer, parts[i]);
+    if (cache != NULL && parts[i]->data != NULL) {
+      func_cache_put(cache, keys[i], parts[i]->data, parts[i]->len, parts[i]->nCommands);
+    }
+    free(parts[i]->data);
+    free(parts[i]);
   }
+
+  free(parts);
+  free(keys);
 }
 
-static void compile_subroutine(CompilationEngine *engine, Function *func) {
+static char *string_getter(int index) {
+  StringBuilder *sb = new_sb();
+  sb_append(sb, "$string");
+  sb_append_i(sb, index);
+  return sb_get(sb);
+}
+
+// function Class.$string<i> 0: builds literal i on its first call and
+// returns the same string from then on
+static void compile_string_getters(CompilationEngine *engine) {
+  StringPool *pool = engine->strings;
+  for (int i = 0; i < pool->literals->len; i++) {
+    char *literal = vec_get(pool->literals, i);
+    char *name = string_getter(i);
+    StringBuilder *sb = new_sb();
+    sb_concat_strings(sb, 2, name, "$READY");
+    char *ready = sb_get(sb);
+
+    write_func(engine->writer, engine->ast->name, name, 0);
+    write_push_i(engine->writer, SEGMENT_STATIC, pool->firstSlot + i);
+    write_if(engine->writer, ready);
+    compile_string(engine, literal);
+    write_pop_i(engine->writer, SEGMENT_STATIC, pool->firstSlot + i);
+    write_label(engine->writer, ready);
+    write_push_i(engine->writer, SEGMENT_STATIC, pool->firstSlot + i);
+    write_return(engine->writer);
+
+    free(name);
+    free(ready);
+  }
+}
+
+// the literals past the limit are built where they are used, as without the pool
+static void remark_unpooled(CompilationEngine *engine) {
+  StringPool *pool = engine->strings;
+  for (int i = 0; i < pool->unpooled->len; i++) {
+    UnpooledString *unpooled = vec_get(pool->unpooled, i);
+    PassContext ctx = pass_context(engine->passes, "pool-strings", engine->ast, unpooled->func);
+    pass_remark(&ctx, REMARK_MISSED, unpooled->line, 0, "\"%s\" is not pooled: the class would use more than %i static slots",
+                unpooled->literal, pool->limit);
+  }
+}
+
+void compile_file(CompilationEngine *engine) {
+  if (pass_enabled(engine->passes, "pool-strings")) {
+    engine->strings = collect_strings(engine->ast, engine->poolLimit);
+    // the calls into the pool depend on its numbering
+    engine->config ^= engine->strings->hash;
+    remark_unpooled(engine);
+  }
+
+  compile_functions(engine);
+
+  if (engine->strings != NULL) {
+    compile_string_getters(engine);
+    free_string_pool(engine->strings);
+    engine->strings = NULL;
+  }
+}
+
+// number of commands generated for func as it currently stands
+static long measure_subroutine(void *arg, Function *func) {
+  CompilationEngine measure = *(CompilationEngine *) arg;
+  measure.writer = new_null_writer();
+  measure.passes = NULL;
+  compile_subroutine(&measure, func);
+  long nCommands = measure.writer->nCommands;
+  free(measure.writer);
+  return nCommands;
+}
+
+// number of commands generated for some statements of func
+static long measure_statements(void *arg, Function *func, Vector *stmts) {
+  CompilationEngine measure = *(CompilationEngine *) arg;
+  measure.writer = new_null_writer();
+  measure.curFunc = func;
+  for (int i = 0; i < stmts->len; i++) {
+    compile_statement(&measure, vec_get(stmts, i));
+  }
+  long nCommands = measure.writer->nCommands;
+  free(measure.writer);
+  return nCommands;
+}
+
+static IrFunction *generate_subroutine(CompilationEngine *engine, Function *func) {
+  VMwriter *out = engine->writer;
+  IrFunction *ir = new_ir_function();
+  engine->writer = new_ir_writer(ir);
+  ir->curLine = func->line;
+
   write_func(engine->writer, engine->ast->name, func->name, varCount(func->lTable, KIND_VAR));
   Vector *stmts = func->statements;
   engine->curFunc = func;
+  engine->labelCounter = 0;
+  engine->extraLocals = 0;
+  engine->liveExtraLocals = 0;
   compile_subroutineBody(engine, stmts);
+  // locals the compiler added while generating the body
+  ir->code[0].operand += engine->extraLocals;
+
+  free(engine->writer);
+  engine->writer = out;
+  return ir;
+}
+
+static void compile_subroutine(CompilationEngine *engine, Function *func) {
+  if (engine->passes != NULL) {
+    Measure measure = {measure_subroutine, measure_statements, engine};
+    run_ast_passes(engine->passes, engine->ast, func, &measure);
+  }
+
+  // the subroutine is generated into IR and printed once it is complete
+  IrFunction *ir = generate_subroutine(engine, func);
+  if (engine->passes != NULL) {
+    run_ir_passes(engine->passes, engine->ast, func, ir, engine->inlines);
+  }
+  print_ir(ir, engine->writer);
+  free_ir_function(ir);
+}
+
+// the IR of func before any pass has seen it
+IrFunction *compile_subroutine_ir(CompilationEngine *engine, Function *func) {
+  CompilationEngine raw = *engine;
+  raw.passes = NULL;
+  raw.strings = NULL;
+  return generate_subroutine(&raw, func);
 }
 
 static void compile_subroutineBody(CompilationEngine *engine, Vector *stmts) {
@@ -73,6 +321,8 @@ static void compile_subroutineBody(CompilationEngine *engine, Vector *stmts) {
 }
 
 static void compile_statement(CompilationEngine *engine, Statement *stmt) {
+  engine->curLine = stmt->line;
+  ir_set_line(engine->writer, stmt->line);
   switch (stmt->type) {
     case LET_STMT:
       compile_let(engine, stmt->letStmt);
@@ -91,27 +341,126 @@ static void compile_statement(CompilationEngine *engine, Statement *stmt) {
       break;
     default:
       xprintf("%i, this statement is not implemented", stmt->type);
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
-char *new_label(char *label, int salt) {
+// labels are scoped by the subroutine (Func$IF_FALSE0), so editing one
+// subroutine leaves the labels of every other one unchanged
+static char *new_label(CompilationEngine *engine, char *label, int salt) {
   StringBuilder *sb = new_sb();
-  sb_concat_strings(sb, 1, label);
+  sb_concat_strings(sb, 3, engine->curFunc->name, "$", label);
   sb_append_i(sb, salt);
   return sb_get(sb);
 }
 
+/*==== Branches ====*/
+
+static bool lower_branches(CompilationEngine *engine) {
+  return pass_enabled(engine->passes, "branches");
+}
+
+static TermPair *last_pair(Expression *expr) {
+  if (expr->termPairs == NULL || expr->termPairs->len == 0) return NULL;
+  return vec_get(expr->termPairs, expr->termPairs->len - 1);
+}
+
+// < and > leave 0 or -1, so the condition can be branched on without a not
+static bool is_ordering(Expression *expr) {
+  TermPair *last = last_pair(expr);
+  return last != NULL && (last->op == '<' || last->op == '>');
+}
+
+// jumps to label exactly when "<cond>; not; if-goto label" would
+static void compile_jump_unless(CompilationEngine *engine, Expression *cond, char *label) {
+  TermPair *last = last_pair(cond);
+  Term *first = cond->firstTerm;
+
+  if (lower_branches(engine) && last == NULL && first->type == TERM_TERM_PAIR && first->termPair->op == '~') {
+    // ~~x is x bit for bit
+    compile_term(engine, first->termPair->term);
+  } else if (lower_branches(engine) && last != NULL && last->op == '=') {
+    // a - b is zero exactly when a = b
+    compile_expression_until(engine, cond, cond->termPairs->len - 1);
+    compile_term(engine, last->term);
+    write_arithmetic(engine->writer, SUB);
+  } else {
+    compile_expression(engine, cond);
+    write_arithmetic(engine->writer, NOT);
+  }
+  write_if(engine->writer, label);
+}
+
+static bool is_boolean_until(Expression *expr, int nPairs);
+
+// true, false, comparisons and their negations leave 0 or -1
+static bool is_boolean_term(Term *term) {
+  switch (term->type) {
+    case TERM_KEYWORD:
+      return term->kConst == KC_TRUE || term->kConst == KC_FALSE;
+    case TERM_EXPR_PARENS:
+      return is_boolean_until(term->expr, term->expr->termPairs != NULL ? term->expr->termPairs->len : 0);
+    case TERM_TERM_PAIR:
+      return term->termPair->op == '~' && is_boolean_term(term->termPair->term);
+    default:
+      return false;
+  }
+}
+
+// whether the first term and nPairs term pairs leave 0 or -1, which makes
+// "if-goto" agree with "not; if-goto" jumping the other way
+static bool is_boolean_until(Expression *expr, int nPairs) {
+  if (nPairs == 0) return is_boolean_term(expr->firstTerm);
+
+  TermPair *pair = vec_get(expr->termPairs, nPairs - 1);
+  if (pair->op == '<' || pair->op == '>' || pair->op == '=') return true;
+  if (pair->op == '&' || pair->op == '|') {
+    return is_boolean_term(pair->term) && is_boolean_until(expr, nPairs - 1);
+  }
+  return false;
+}
+
+static bool is_boolean(Expression *expr) {
+  return is_boolean_until(expr, expr->termPairs != NULL ? expr->termPairs->len : 0);
+}
+
+static long expression_size(CompilationEngine *engine, Expression *expr) {
+  CompilationEngine measure = *engine;
+  measure.writer = new_null_writer();
+  compile_expression(&measure, expr);
+  long nCommands = measure.writer->nCommands;
+  free(measure.writer);
+  return nCommands;
+}
+
 static void compile_if(CompilationEngine *engine, IfStmt *stmt) {
-  char *elseLabel = new_label("IF_FALSE", engine->labelCounter);
-  char *endLabel = new_label("IF_END", engine->labelCounter);
+  char *elseLabel = new_label(engine, "IF_FALSE", engine->labelCounter);
+  char *endLabel = new_label(engine, "IF_END", engine->labelCounter);
   engine->labelCounter++;
 
-  compile_expression(engine, stmt->expr);
-  write_arithmetic(engine->writer, NOT);
-  write_if(engine->writer, elseLabel);
+  bool hasElse = stmt->elseStmts != NULL && stmt->elseStmts->len > 0;
+  if (lower_branches(engine) && hasElse && is_ordering(stmt->expr)) {
+    // branching to the then part with the else part first needs no not
+    char *trueLabel = new_label(engine, "IF_TRUE", engine->labelCounter - 1);
+    compile_expression(engine, stmt->expr);
+    write_if(engine->writer, trueLabel);
+    compile_subroutineBody(engine, stmt->elseStmts);
+    write_goto(engine->writer, endLabel);
+    write_label(engine->writer, trueLabel);
+    compile_subroutineBody(engine, stmt->ifStmts);
+    write_label(engine->writer, endLabel);
+    return;
+  }
 
+  compile_jump_unless(engine, stmt->expr, elseLabel);
   compile_subroutineBody(engine, stmt->ifStmts);
+
+  if (lower_branches(engine) && !hasElse) {
+    // without an else part the end is the false label
+    write_label(engine->writer, elseLabel);
+    return;
+  }
+
   write_goto(engine->writer, endLabel);
 
   write_label(engine->writer, elseLabel);
@@ -143,7 +492,7 @@ static void compile_let(CompilationEngine *engine, LetStmt *stmt) {
 
       if (kind == KIND_NONE) {
         xprintf("%s is not defined", stmt->name);
-        exit(EXIT_FAILURE);
+        abort_compilation();
       }
 
       compile_expression(engine, stmt->secondExpr);
@@ -158,20 +507,62 @@ static void compile_let(CompilationEngine *engine, LetStmt *stmt) {
     }
     default:
       xprintf("unknown let statement type");
-      exit(EXIT_FAILURE);
+      abort_compilation();
+  }
+}
+
+// longest condition copied in front of a rotated loop; longer ones are
+// reached by a jump to the test at the bottom
+#define MAX_DUPLICATED_CONDITION 8
+
+// the test sits below the body, so an iteration takes a single branch
+static void compile_rotated_while(CompilationEngine *engine, WhileStmt *stmt, char *whileFalse) {
+  char *whileBody = new_label(engine, "WHILE_BODY", engine->labelCounter - 1);
+  char *whileTest = new_label(engine, "WHILE_TEST", engine->labelCounter - 1);
+  bool duplicate = engine->passes->level != OPT_OS &&
+                   expression_size(engine, stmt->expr) <= MAX_DUPLICATED_CONDITION;
+
+  if (duplicate) {
+    compile_jump_unless(engine, stmt->expr, whileFalse);
+  } else {
+    write_goto(engine->writer, whileTest);
+  }
+
+  write_label(engine->writer, whileBody);
+  compile_subroutineBody(engine, stmt->stmts);
+  if (!duplicate) {
+    write_label(engine->writer, whileTest);
+  }
+  compile_expression(engine, stmt->expr);
+  write_if(engine->writer, whileBody);
+
+  if (duplicate) {
+    write_label(engine->writer, whileFalse);
   }
 }
 
 static void compile_while(CompilationEngine *engine, WhileStmt *stmt) {
-  char *whileStart = new_label("WHILE_START", engine->labelCounter);
-  char *whileFalse = new_label("WHILE_FALSE", engine->labelCounter);
+  char *whileStart = new_label(engine, "WHILE_START", engine->labelCounter);
+  char *whileFalse = new_label(engine, "WHILE_FALSE", engine->labelCounter);
   engine->labelCounter++;
 
+  if (pass_enabled(engine->passes, "rotate-loops") && is_boolean(stmt->expr)) {
+    compile_rotated_while(engine, stmt, whileFalse);
+    return;
+  }
+
   write_label(engine->writer, whileStart);
 
-  compile_expression(engine, stmt->expr);
-  write_arithmetic(engine->writer, NOT);
-  write_if(engine->writer, whileFalse);
+  if (lower_branches(engine) && engine->passes->level != OPT_OS && is_ordering(stmt->expr)) {
+    // the not would run on every iteration, the extra goto only on exit
+    char *whileBody = new_label(engine, "WHILE_BODY", engine->labelCounter - 1);
+    compile_expression(engine, stmt->expr);
+    write_if(engine->writer, whileBody);
+    write_goto(engine->writer, whileFalse);
+    write_label(engine->writer, whileBody);
+  } else {
+    compile_jump_unless(engine, stmt->expr, whileFalse);
+  }
 
   compile_subroutineBody(engine, stmt->stmts);
   write_goto(engine->writer, whileStart);
@@ -189,18 +580,111 @@ static void compile_return(CompilationEngine *engine, ReturnStmt *stmt) {
   write_return(engine->writer);
 }
 
+static void compile_string(CompilationEngine *engine, char *str) {
+  size_t len = strlen(str);
+  write_push_i(engine->writer, SEGMENT_CONST, len);
+  write_call(engine->writer, "String", "new", 1);
+  for (int i = 0; i < len; i++) {
+    char chr = str[i];
+    write_push_i(engine->writer, SEGMENT_CONST, chr);
+    write_call(engine->writer, "String", "appendChar", 2);
+  }
+}
+
 static void compile_expression(CompilationEngine *engine, Expression *expr) {
+  compile_expression_until(engine, expr, expr->termPairs != NULL ? expr->termPairs->len : 0);
+}
+
+// the first term and the operations of the first nPairs term pairs
+static void compile_expression_until(CompilationEngine *engine, Expression *expr, int nPairs) {
   compile_term(engine, expr->firstTerm);
 
   if (expr->termPairs == NULL) return;
 
-  for (int i = 0; i < expr->termPairs->len; i++) {
+  for (int i = 0; i < nPairs; i++) {
     TermPair *pair = vec_get(expr->termPairs, i);
     compile_term(engine, pair->term);
     compile_operator(engine, pair->op);
   }
 }
 
+// calls into classes of the program are checked against their headers;
+// classes outside of it (the OS) are taken on trust
+static void check_call(CompilationEngine *engine, char *className, SubroutineCall *call, int nArgs) {
+  if (!has_class_signature(engine->signatures, className)) return;
+
+  Signature *sig = find_signature(engine->signatures, className, call->subroutineName);
+  if (sig == NULL) {
+    xprintf("line %i: %s.%s is not defined\n", engine->curLine, className, call->subroutineName);
+    abort_compilation();
+  }
+
+  if (sig->nParams != nArgs) {
+    xprintf("line %i: %s.%s expects %i argument%s but %i %s given\n", engine->curLine, className,
+            call->subroutineName, sig->nParams, sig->nParams == 1 ? "" : "s", nArgs, nArgs == 1 ? "is" : "are");
+    abort_compilation();
+  }
+}
+
+/*==== Literal disposal ====*/
+
+// a literal built for this very argument, which nobody else refers to
+static bool is_fresh_literal(CompilationEngine *engine, Expression *expr) {
+  if (expr->termPairs != NULL && expr->termPairs->len > 0) return false;
+  if (expr->firstTerm->type != TERM_STR) return false;
+  return engine->strings == NULL || string_index(engine->strings, expr->firstTerm->str) < 0;
+}
+
+// a function on the allowlist of callees that do not keep their arguments
+static bool disposes_literals(CompilationEngine *engine, SubroutineCall *call) {
+  if (!pass_enabled(engine->passes, "dispose-strings") || engine->nonRetaining == NULL) return false;
+
+  bool allowed = false;
+  for (int i = 0; i < engine->nonRetaining->len && !allowed; i++) {
+    char *name = vec_get(engine->nonRetaining, i);
+    char *dot = strchr(name, '.');
+    allowed = dot != NULL && !strncmp(name, call->target, dot - name) && call->target[dot - name] == '\0' &&
+              !strcmp(dot + 1, call->subroutineName);
+  }
+
+  for (int i = 0; allowed && i < call->exprList->expressions->len; i++) {
+    if (is_fresh_literal(engine, vec_get(call->exprList->expressions, i))) return true;
+  }
+  return false;
+}
+
+// keeps each literal argument in a local added to the subroutine (temps
+// do not survive the call) and disposes of it once the call returns
+static void compile_disposing_call(CompilationEngine *engine, SubroutineCall *call, int nArgs) {
+  Vector *exprs = call->exprList->expressions;
+  int firstLocal = varCount(engine->curFunc->lTable, KIND_VAR) + engine->liveExtraLocals;
+  int nKept = 0;
+
+  for (int i = 0; i < exprs->len; i++) {
+    Expression *expr = vec_get(exprs, i);
+    compile_expression(engine, expr);
+    if (is_fresh_literal(engine, expr)) {
+      write_pop_i(engine->writer, SEGMENT_LOCAL, firstLocal + nKept);
+      write_push_i(engine->writer, SEGMENT_LOCAL, firstLocal + nKept);
+      nKept++;
+      engine->liveExtraLocals++;
+    }
+  }
+  if (engine->liveExtraLocals > engine->extraLocals) {
+    engine->extraLocals = engine->liveExtraLocals;
+  }
+
+  write_call(engine->writer, call->target, call->subroutineName, nArgs);
+
+  // the result of the call stays on the stack
+  for (int i = 0; i < nKept; i++) {
+    write_push_i(engine->writer, SEGMENT_LOCAL, firstLocal + i);
+    write_call(engine->writer, "String", "dispose", 1);
+    write_pop_i(engine->writer, SEGMENT_TEMP, 0);
+  }
+  engine->liveExtraLocals -= nKept;
+}
+
 static void compile_subroutineCall(CompilationEngine *engine, SubroutineCall *call) {
   enum SubCallType type = call->type;
 
@@ -215,6 +699,7 @@ static void compile_subroutineCall(CompilationEngine *engine, SubroutineCall *ca
       compile_expression_list(engine, call->exprList);
     }
 
+    check_call(engine, engine->ast->name, call, nArgs);
     write_call(engine->writer, engine->ast->name, call->subroutineName, nArgs + 1);
     return;
   }
@@ -224,9 +709,15 @@ static void compile_subroutineCall(CompilationEngine *engine, SubroutineCall *ca
   }
 
   char *targetType = find_type(engine, call->target);
+  check_call(engine, targetType != NULL ? targetType : call->target, call, nArgs);
 
   // static function call
   if (targetType == NULL) {
+    if (call->exprList != NULL && disposes_literals(engine, call)) {
+      compile_disposing_call(engine, call, nArgs);
+      return;
+    }
+
     if (call->exprList != NULL) {
       compile_expression_list(engine, call->exprList);
     }
@@ -260,13 +751,13 @@ static void compile_term(CompilationEngine *engine, Term *term) {
       write_push(engine->writer, SEGMENT_CONST, term->integer);
       break;
     case TERM_STR: {
-      size_t len = strlen(term->str);
-      write_push_i(engine->writer, SEGMENT_CONST, len);
-      write_call(engine->writer, "String", "new", 1);
-      for (int i = 0; i < len; i++) {
-        char chr = term->str[i];
-        write_push_i(engine->writer, SEGMENT_CONST, chr);
-        write_call(engine->writer, "String", "appendChar", 2);
+      int index = engine->strings != NULL ? string_index(engine->strings, term->str) : -1;
+      if (index >= 0) {
+        char *getter = string_getter(index);
+        write_call(engine->writer, engine->ast->name, getter, 0);
+        free(getter);
+      } else {
+        compile_string(engine, term->str);
       }
       break;
     }
@@ -286,7 +777,7 @@ static void compile_term(CompilationEngine *engine, Term *term) {
           break;
         default:
           xprintf("undefined TERM_KEYWORD");
-          exit(EXIT_FAILURE);
+          abort_compilation();
       }
       break;
     }
@@ -316,7 +807,7 @@ static void compile_term(CompilationEngine *engine, Term *term) {
 
       if (kind == KIND_NONE) {
         xprintf("%s is not defined", term->array->varName);
-        exit(EXIT_FAILURE);
+        abort_compilation();
       }
 
       compile_expression(engine, term->array->expr);
@@ -372,7 +863,7 @@ static void compile_operator(CompilationEngine *engine, char op) {
       write_arithmetic(engine->writer, EQ);
       break;
     default:
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -386,7 +877,7 @@ static void compile_unary_operator(CompilationEngine *engine, char op) {
       break;
     default:
       xprintf("%c is not implemented in compile_unary_operator", op);
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -402,7 +893,7 @@ static Segment kind_to_segment(Kind kind) {
       return SEGMENT_STATIC;
     default:
       xprintf("%i not implemented in kind_to_segment", kind);
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -413,7 +904,7 @@ static int find_index(CompilationEngine *engine, char *identName) {
 
     if (index == NO_IDENTIFIER) {
       xprintf("%s is not defined in class %s", identName, engine->ast->name);
-      exit(EXIT_FAILURE);
+      abort_compilation();
     }
   }
 
@@ -427,7 +918,7 @@ static Kind find_kind(CompilationEngine *engine, char *identName) {
 
     if (kind == KIND_NONE) {
       xprintf("%s is not defined in class %s", identName, engine->ast->name);
-      exit(EXIT_FAILURE);
+      abort_compilation();
     }
   }
 
@@ -9,15 +9,40 @@
 #include "symbol_table.h"
 #include "vm_writer.h"
 #include "parser.h"
+#include "func_cache.h"
+#include "pass_manager.h"
+#include "signature_index.h"
+#include "vm_ir.h"
+#include "string_pool.h"
 
 typedef struct {
   VMwriter *writer;
   Class *ast;
   Function *curFunc;
   int labelCounter;
+  int jobs;
+  FuncCache *funcCache;
+  PassManager *passes;
+  // headers of every class of the program
+  SignatureIndex *signatures;
+  int curLine;
+  // settings that change the generated code, part of the function cache key
+  uint64_t config;
+  // the literals of the class when they are pooled, NULL otherwise
+  StringPool *strings;
+  // most static slots a class may use once its literals are pooled
+  int poolLimit;
+  // "Class.function" names of callees that neither keep nor return string arguments
+  Vector *nonRetaining;
+  // locals added to the current subroutine beyond the declared ones
+  int extraLocals;
+  int liveExtraLocals;
+  // bodies of whole-program subroutines that calls may be replaced with
+  InlineTable *inlines;
 } CompilationEngine;
 
-CompilationEngine *new_engine(char *fileName, Class *class);
+CompilationEngine *new_engine(VMwriter *writer, Class *class);
 void compile_file(CompilationEngine *engine);
+IrFunction *compile_subroutine_ir(CompilationEngine *engine, Function *func);
 
 #endif //COMPILER_COMPILATION_ENGINE_H
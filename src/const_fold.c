@@ -0,0 +1,398 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "passes.h"
+
+// Jack has no operator precedence: a + b * c is (a + b) * c. Values are 16-bit
+// two's complement words, and the OS multiply wraps the same way.
+
+typedef struct {
+  PassContext *ctx;
+  // line of the statement being folded
+  int line;
+} Folder;
+
+static int fold_expression(Folder *folder, Expression *expr);
+
+static int wrap(int value) {
+  return (int16_t) value;
+}
+
+/*============================ Constants ============================ */
+
+static bool term_value(Term *term, int *value) {
+  switch (term->type) {
+    case TERM_INT:
+      *value = wrap(atoi(term->integer));
+      return true;
+    case TERM_KEYWORD:
+      if (term->kConst == KC_THIS) return false;
+      *value = term->kConst == KC_TRUE ? -1 : 0;
+      return true;
+    case TERM_TERM_PAIR: {
+      int inner;
+      if (!term_value(term->termPair->term, &inner)) return false;
+      *value = term->termPair->op == '-' ? wrap(-inner) : wrap(~inner);
+      return true;
+    }
+    case TERM_EXPR_PARENS:
+      return term->expr->termPairs == NULL || term->expr->termPairs->len == 0
+             ? term_value(term->expr->firstTerm, value) : false;
+    default:
+      return false;
+  }
+}
+
+static Term *new_int_term(int value) {
+  Term *term = malloc(sizeof(Term));
+  term->type = TERM_INT;
+  term->integer = number_to_string(value);
+  return term;
+}
+
+static Term *new_unary_term(char op, Term *inner) {
+  Term *term = malloc(sizeof(Term));
+  term->type = TERM_TERM_PAIR;
+  term->termPair = malloc(sizeof(TermPair));
+  term->termPair->op = op;
+  term->termPair->term = inner;
+  return term;
+}
+
+// push constant only takes 0..32767, so negative values become -n and
+// -32768, whose negation does not fit, becomes ~32767
+static Term *new_const_term(int value) {
+  if (value >= 0) return new_int_term(value);
+  if (value == -32768) return new_unary_term('~', new_int_term(32767));
+  return new_unary_term('-', new_int_term(-value));
+}
+
+// the form new_const_term would produce; replacing it again gains nothing
+static bool is_canonical(Term *term) {
+  if (term->type == TERM_INT) return true;
+  if (term->type != TERM_TERM_PAIR || term->termPair->term->type != TERM_INT) return false;
+  return term->termPair->op == '-' || !strcmp(term->termPair->term->integer, "32767");
+}
+
+static bool is_pure_expression(Expression *expr);
+
+// false if evaluating the term may call a subroutine
+static bool is_pure_term(Term *term) {
+  switch (term->type) {
+    case TERM_SUB_CALL:
+      return false;
+    case TERM_TERM_PAIR:
+      return is_pure_term(term->termPair->term);
+    case TERM_EXPR_PARENS:
+      return is_pure_expression(term->expr);
+    case TERM_ARRAY:
+      return is_pure_expression(term->array->expr);
+    default:
+      return true;
+  }
+}
+
+static bool is_pure_expression(Expression *expr) {
+  if (!is_pure_term(expr->firstTerm)) return false;
+  for (int i = 0; expr->termPairs != NULL && i < expr->termPairs->len; i++) {
+    TermPair *pair = vec_get(expr->termPairs, i);
+    if (!is_pure_term(pair->term)) return false;
+  }
+  return true;
+}
+
+static bool same_term(Term *a, Term *b) {
+  if (a->type != b->type) return false;
+  if (a->type == TERM_VAR) return !strcmp(a->varName, b->varName);
+  return false;
+}
+
+/*============================ Evaluation ============================ */
+
+// false when the result would differ from what the VM and the OS compute
+static bool evaluate(Folder *folder, char op, int left, int right, int *result) {
+  switch (op) {
+    case '+':
+      *result = wrap(left + right);
+      return true;
+    case '-':
+      *result = wrap(left - right);
+      return true;
+    case '*':
+      *result = wrap(left * right);
+      return true;
+    case '/':
+      if (right == 0) {
+        pass_remark(folder->ctx, REMARK_MISSED, folder->line, 0, "division by zero is left to run time");
+        return false;
+      }
+      // Math.divide works on absolute values, which -32768 does not have
+      if (left == -32768 || right == -32768) return false;
+      *result = left / right;
+      return true;
+    case '&':
+      *result = left & right;
+      return true;
+    case '|':
+      *result = wrap(left | right);
+      return true;
+    case '<': case '>': case '=':
+      // lt and gt compare by subtracting, which overflows for distant values
+      if (op != '=' && wrap(left - right) != left - right) return false;
+      if (op == '<') *result = left < right ? -1 : 0;
+      if (op == '>') *result = left > right ? -1 : 0;
+      if (op == '=') *result = left == right ? -1 : 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*============================ Folding ============================ */
+
+static int fold_term(Folder *folder, Term **slot) {
+  Term *term = *slot;
+  int changes = 0;
+
+  switch (term->type) {
+    case TERM_EXPR_PARENS:
+      changes += fold_expression(folder, term->expr);
+      // (x) is x
+      if (term->expr->termPairs == NULL || term->expr->termPairs->len == 0) {
+        *slot = term->expr->firstTerm;
+      }
+      break;
+    case TERM_TERM_PAIR: {
+      TermPair *pair = term->termPair;
+      changes += fold_term(folder, &pair->term);
+      Term *inner = pair->term;
+
+      // ~~x and --x
+      if (inner->type == TERM_TERM_PAIR && inner->termPair->op == pair->op) {
+        *slot = inner->termPair->term;
+        return changes + 1;
+      }
+
+      int value;
+      if (!is_canonical(term) && term_value(term, &value)) {
+        *slot = new_const_term(value);
+        changes++;
+      }
+      break;
+    }
+    case TERM_ARRAY:
+      changes += fold_expression(folder, term->array->expr);
+      break;
+    case TERM_SUB_CALL: {
+      ExpressionList *list = term->subCall->exprList;
+      for (int i = 0; list != NULL && i < list->expressions->len; i++) {
+        changes += fold_expression(folder, vec_get(list->expressions, i));
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return changes;
+}
+
+static bool is_additive(TermPair *pair, int *value) {
+  return (pair->op == '+' || pair->op == '-') && term_value(pair->term, value);
+}
+
+// turns the + or - pair into one that adds value
+static void set_addend(TermPair *pair, int value) {
+  if (value > 0 || value == -32768) {
+    pair->op = '+';
+    pair->term = new_const_term(value);
+  } else {
+    pair->op = '-';
+    pair->term = new_int_term(-value);
+  }
+}
+
+// folds the constant prefix, drops neutral operands, combines runs of added
+// constants and applies x*0, 0*x, x&0 and x-x when nothing with a side effect
+// is thrown away; the pairs are compacted in place
+static int fold_expression(Folder *folder, Expression *expr) {
+  int changes = fold_term(folder, &expr->firstTerm);
+  Vector *pairs = expr->termPairs;
+  if (pairs == NULL) return changes;
+
+  for (int i = 0; i < pairs->len; i++) {
+    TermPair *pair = vec_get(pairs, i);
+    changes += fold_term(folder, &pair->term);
+  }
+
+  int acc;
+  bool prefixConst = term_value(expr->firstTerm, &acc);
+  bool prefixChanged = false;
+  bool prefixPure = is_pure_term(expr->firstTerm);
+  int kept = 0;
+
+  for (int i = 0; i < pairs->len; i++) {
+    TermPair *pair = vec_get(pairs, i);
+    char op = pair->op;
+    int value;
+    bool isConst = term_value(pair->term, &value);
+
+    // the whole prefix is known
+    if (prefixConst && isConst && evaluate(folder, op, acc, value, &acc)) {
+      prefixChanged = true;
+      changes++;
+      continue;
+    }
+
+    // neutral right operands
+    if (isConst && ((value == 0 && (op == '+' || op == '-' || op == '|')) || (value == 1 && (op == '*' || op == '/')))) {
+      changes++;
+      continue;
+    }
+
+    // absorbing right operands
+    if (isConst && value == 0 && (op == '*' || op == '&')) {
+      if (prefixPure) {
+        kept = 0;
+        acc = 0;
+        prefixConst = prefixChanged = true;
+        changes++;
+        continue;
+      }
+      pass_remark(folder->ctx, REMARK_MISSED, folder->line, 0,
+                  "'%c 0' is kept because the left operand calls a subroutine", op);
+    }
+
+    // x + 1 + 2 is x + 3
+    int previous;
+    if (isConst && kept > 0 && !prefixConst && is_additive(pair, &value)
+        && is_additive(vec_get(pairs, kept - 1), &previous)) {
+      TermPair *last = vec_get(pairs, kept - 1);
+      int sum = wrap((last->op == '+' ? previous : -previous) + (op == '+' ? value : -value));
+      if (sum == 0) {
+        kept--;
+      } else {
+        set_addend(last, sum);
+      }
+      changes++;
+      continue;
+    }
+
+    if (prefixConst && kept == 0) {
+      // 0 + x, 0 | x and 1 * x are x
+      if ((acc == 0 && (op == '+' || op == '|')) || (acc == 1 && op == '*')) {
+        expr->firstTerm = pair->term;
+        prefixConst = isConst;
+        prefixChanged = false;
+        acc = value;
+        prefixPure = is_pure_term(pair->term);
+        changes++;
+        continue;
+      }
+      // 0 * x and 0 & x are 0; 0 / x is left alone since x may be 0
+      if (acc == 0 && (op == '*' || op == '&') && is_pure_term(pair->term)) {
+        changes++;
+        continue;
+      }
+    }
+
+    // x - x
+    if (op == '-' && kept == 0 && !prefixConst && is_pure_term(expr->firstTerm)
+        && same_term(expr->firstTerm, pair->term)) {
+      acc = 0;
+      prefixConst = prefixChanged = true;
+      changes++;
+      continue;
+    }
+
+    // x - -5 and x + true become x + 5 and x - 1
+    if (isConst && (op == '+' || op == '-') && pair->term->type != TERM_INT) {
+      int addend = wrap(op == '+' ? value : -value);
+      if (addend != -32768) {
+        set_addend(pair, addend);
+        changes++;
+      }
+    }
+
+    if (prefixConst && prefixChanged && kept == 0) {
+      expr->firstTerm = new_const_term(acc);
+    }
+    prefixConst = prefixChanged = false;
+    prefixPure = prefixPure && is_pure_term(pair->term);
+    pairs->data[kept++] = pair;
+  }
+
+  if (prefixConst && prefixChanged && kept == 0) {
+    expr->firstTerm = new_const_term(acc);
+  }
+  pairs->len = kept;
+  return changes;
+}
+
+static int fold_statements(Folder *folder, Vector *stmts);
+
+static int fold_own_expressions(Folder *folder, Statement *stmt) {
+  switch (stmt->type) {
+    case LET_STMT: {
+      int changes = fold_expression(folder, stmt->letStmt->secondExpr);
+      if (stmt->letStmt->type == LET_TYPE_ARRAY) {
+        changes += fold_expression(folder, stmt->letStmt->firstExpr);
+      }
+      return changes;
+    }
+    case IF_STMT:
+      return fold_expression(folder, stmt->ifStmt->expr);
+    case WHILE_STMT:
+      return fold_expression(folder, stmt->whileStmt->expr);
+    case DO_STMT: {
+      ExpressionList *list = stmt->doStmt->call->exprList;
+      int changes = 0;
+      for (int i = 0; list != NULL && i < list->expressions->len; i++) {
+        changes += fold_expression(folder, vec_get(list->expressions, i));
+      }
+      return changes;
+    }
+    case RETURN_STMT:
+      return stmt->retStmt->expr != NULL ? fold_expression(folder, stmt->retStmt->expr) : 0;
+    default:
+      return 0;
+  }
+}
+
+static long measure_statement(PassContext *ctx, Statement *stmt) {
+  Vector one = {(void **) &stmt, 1, 1};
+  return ctx->measure->statements(ctx->measure->arg, ctx->func, &one);
+}
+
+static int fold_statements(Folder *folder, Vector *stmts) {
+  PassContext *ctx = folder->ctx;
+  int changes = 0;
+
+  for (int i = 0; stmts != NULL && i < stmts->len; i++) {
+    Statement *stmt = vec_get(stmts, i);
+
+    // nested statements report for themselves
+    if (stmt->type == IF_STMT) {
+      changes += fold_statements(folder, stmt->ifStmt->ifStmts);
+      changes += fold_statements(folder, stmt->ifStmt->elseStmts);
+    } else if (stmt->type == WHILE_STMT) {
+      changes += fold_statements(folder, stmt->whileStmt->stmts);
+    }
+
+    bool remarks = remarks_wanted(ctx, REMARK_PASSED);
+    long before = remarks ? measure_statement(ctx, stmt) : 0;
+    folder->line = stmt->line;
+    int folded = fold_own_expressions(folder, stmt);
+
+    if (folded > 0 && remarks) {
+      pass_remark(ctx, REMARK_PASSED, stmt->line, before - measure_statement(ctx, stmt),
+                  "folded %i constant operation%s", folded, folded == 1 ? "" : "s");
+    }
+    changes += folded;
+  }
+  return changes;
+}
+
+int fold_constants(PassContext *ctx) {
+  Folder folder = {ctx, ctx->func->line};
+  return fold_statements(&folder, ctx->func->statements);
+}
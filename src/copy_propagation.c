@@ -0,0 +1,133 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "passes.h"
+#include "dataflow.h"
+
+// A local or argument that was last stored with "push S; pop V" is read as S
+// where S is a constant or a variable that still holds what was copied. The
+// copies this leaves unread go with the other dead stores: pops to locals and
+// arguments whose value no path reads again. Only locals and arguments are
+// followed; the subroutine alone stores to them, while this, static and that
+// may change through callees and other pointers.
+
+static bool reachable(Dataflow *df, int command) {
+  return df->blocks[df->blockOf[command]].rpo != -1;
+}
+
+// the push of "push S; pop V" when the value a push reads is such a copy
+static int copy_source(Dataflow *df, int use) {
+  int value = df->valueOf[use];
+  if (value == -1 || df->values[value].command < 0) return -1;
+
+  int pop = df->values[value].command;
+  IrInstr *source = &df->ir->code[pop - 1];
+  if (source->op != IR_PUSH || df->blockOf[pop - 1] != df->blockOf[pop]) return -1;
+  if (source->arg == SEGMENT_CONST || dataflow_variable(df, source) != -1) return pop - 1;
+  return -1;
+}
+
+// reading the source instead of the copy moves each read to a value whose
+// definition dominates the one before, so the rounds come to an end
+int propagate_copies(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  Dataflow *df = new_dataflow(ir);
+  int changes = 0;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < ir->len; i++) {
+      IrInstr *instr = &ir->code[i];
+      if (instr->op != IR_PUSH || dataflow_variable(df, instr) == -1 || !reachable(df, i)) continue;
+      int source = copy_source(df, i);
+      if (source == -1) continue;
+
+      IrInstr *from = &ir->code[source];
+      int value = -1;
+      if (from->arg != SEGMENT_CONST) {
+        value = df->valueOf[source];
+        if (value == -1 || ssa_value_at(df, i, dataflow_variable(df, from)) != value) continue;
+      }
+
+      if (remarks_wanted(ctx, REMARK_PASSED)) {
+        char copy[64], original[64];
+        describe_variable(df, ctx->func, dataflow_variable(df, instr), copy, sizeof(copy));
+        if (value == -1) {
+          snprintf(original, sizeof(original), "constant %i", from->operand);
+        } else {
+          describe_variable(df, ctx->func, dataflow_variable(df, from), original, sizeof(original));
+        }
+        pass_remark(ctx, REMARK_PASSED, ir->lines[i], 0, "%s read in place of its copy %s", original, copy);
+      }
+      instr->arg = from->arg;
+      instr->operand = from->operand;
+      df->valueOf[i] = value;
+      changed = true;
+      changes++;
+    }
+  }
+
+  free_dataflow(df);
+  return changes;
+}
+
+// the first command of the value a pop stores if computing it has no
+// effect besides the value, else -1
+static int pure_operand(IrFunction *ir, int pop) {
+  int start = ir_operand_start(ir, pop);
+  for (int i = start; i != -1 && i < pop; i++) {
+    if (ir->code[i].op != IR_PUSH && ir->code[i].op != IR_ARITHMETIC) return -1;
+  }
+  return start;
+}
+
+// Removing a store can leave the stores of the variables it read unread in
+// turn, so the facts are computed again until a round removes nothing. A
+// value that takes a call to compute is still computed but popped to temp 0,
+// as do statements discard theirs, so that the variable may go unused.
+int eliminate_dead_stores(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  int changes = 0;
+  int *dead = malloc(sizeof(int) * ir->len);
+  char name[64];
+
+  for (;;) {
+    Dataflow *df = new_dataflow(ir);
+    int nDead = 0;
+    int discarded = 0;
+    for (int i = 1; i < ir->len; i++) {
+      IrInstr *instr = &ir->code[i];
+      int var = dataflow_variable(df, instr);
+      if (instr->op != IR_POP || var == -1 || !reachable(df, i) || live_after(df, i, var)) continue;
+      if (pure_operand(ir, i) != -1) {
+        dead[nDead++] = i;
+        continue;
+      }
+
+      if (remarks_wanted(ctx, REMARK_PASSED)) {
+        describe_variable(df, ctx->func, var, name, sizeof(name));
+        pass_remark(ctx, REMARK_PASSED, ir->lines[i], 0, "the value stored to %s is never read and is discarded", name);
+      }
+      *instr = ir_instr(IR_POP, SEGMENT_TEMP, 0, -1);
+      discarded++;
+    }
+
+    for (int d = nDead - 1; d >= 0; d--) {
+      int start = pure_operand(ir, dead[d]);
+      if (remarks_wanted(ctx, REMARK_PASSED)) {
+        describe_variable(df, ctx->func, dataflow_variable(df, &ir->code[dead[d]]), name, sizeof(name));
+        pass_remark(ctx, REMARK_PASSED, ir->lines[dead[d]], dead[d] - start + 1,
+                    "removed the store to %s, which is never read", name);
+      }
+      ir_remove(ir, start, dead[d] - start + 1);
+    }
+
+    free_dataflow(df);
+    changes += nDead + discarded;
+    if (nDead == 0) break;
+  }
+
+  free(dead);
+  return changes;
+}
@@ -0,0 +1,411 @@
+
+#include <stdlib.h>
+#include "passes.h"
+
+// Local value numbering: inside a block every value the code computes gets a
+// number, and two computations share a number exactly when they yield the
+// same word. A pure computation whose number a local or temp already holds
+// becomes a push of it; one that repeats an earlier computation keeps the
+// earlier result in a free temp instead.
+
+typedef enum {
+  KEY_CONST,
+  // static, this or that at some version of memory
+  KEY_MEMORY,
+  KEY_OPERATION
+} KeyKind;
+
+// operations that are calls, told apart from the arithmetic commands
+#define MULTIPLY (-1)
+#define DIVIDE (-2)
+// any other call
+#define OPAQUE (-3)
+
+typedef struct {
+  KeyKind kind;
+  int a, b, c, d;
+} Key;
+
+// a local, argument, temp or pointer and the number of its value
+typedef struct {
+  Segment segment;
+  int index;
+  int number;
+} Holder;
+
+typedef struct {
+  int number;
+  // first command of the code that computed it, -1 if that code is not
+  // part of the block or not pure
+  int start;
+} Value;
+
+typedef struct {
+  int number;
+  int start;
+  int end;
+} Occurrence;
+
+typedef struct {
+  PassContext *ctx;
+  IrFunction *ir;
+  // whether pointer 0 may be read after a block
+  bool thisLive;
+
+  Key *keys;
+  int *numbers;
+  int nKeys;
+  Holder *holders;
+  int nHolders;
+  int nextNumber;
+  // changes with every store that may reach static, this or that
+  int memory;
+
+  Value *stack;
+  int depth;
+  Occurrence *seen;
+  int nSeen;
+  int pointerStart[2];
+} Cse;
+
+#define MAX_ENTRIES(len) ((len) + 8)
+
+/*============================ Numbering ============================ */
+
+static bool same_key(Key *a, Key *b) {
+  return a->kind == b->kind && a->a == b->a && a->b == b->b && a->c == b->c && a->d == b->d;
+}
+
+static int number_of(Cse *cse, Key key) {
+  for (int i = 0; i < cse->nKeys; i++) {
+    if (same_key(&cse->keys[i], &key)) return cse->numbers[i];
+  }
+  cse->keys[cse->nKeys] = key;
+  cse->numbers[cse->nKeys++] = cse->nextNumber;
+  return cse->nextNumber++;
+}
+
+static void set_number(Cse *cse, Key key, int number) {
+  cse->keys[cse->nKeys] = key;
+  cse->numbers[cse->nKeys++] = number;
+}
+
+static Holder *find_holder(Cse *cse, Segment segment, int index) {
+  for (int i = 0; i < cse->nHolders; i++) {
+    if (cse->holders[i].segment == segment && cse->holders[i].index == index) return &cse->holders[i];
+  }
+  return NULL;
+}
+
+static void hold(Cse *cse, Segment segment, int index, int number) {
+  Holder *holder = find_holder(cse, segment, index);
+  if (holder == NULL) {
+    holder = &cse->holders[cse->nHolders++];
+    holder->segment = segment;
+    holder->index = index;
+  }
+  holder->number = number;
+}
+
+static int held(Cse *cse, Segment segment, int index) {
+  Holder *holder = find_holder(cse, segment, index);
+  if (holder != NULL) return holder->number;
+  hold(cse, segment, index, cse->nextNumber);
+  return cse->nextNumber++;
+}
+
+static int load(Cse *cse, IrInstr *push) {
+  Key key = {KEY_MEMORY, push->arg, push->operand, -1, cse->memory};
+  switch (push->arg) {
+    case SEGMENT_CONST:
+      key.kind = KEY_CONST;
+      key.d = 0;
+      return number_of(cse, key);
+    case SEGMENT_STATIC:
+      return number_of(cse, key);
+    case SEGMENT_THIS:
+      key.c = held(cse, SEGMENT_POINTER, 0);
+      return number_of(cse, key);
+    case SEGMENT_THAT:
+      key.c = held(cse, SEGMENT_POINTER, 1);
+      return number_of(cse, key);
+    default:
+      return held(cse, push->arg, push->operand);
+  }
+}
+
+static void store(Cse *cse, IrInstr *pop, int number) {
+  switch (pop->arg) {
+    case SEGMENT_STATIC: case SEGMENT_THIS: case SEGMENT_THAT: {
+      cse->memory++;
+      int pointer = pop->arg == SEGMENT_THIS ? held(cse, SEGMENT_POINTER, 0)
+                    : pop->arg == SEGMENT_THAT ? held(cse, SEGMENT_POINTER, 1) : -1;
+      Key key = {KEY_MEMORY, pop->arg, pop->operand, pointer, cse->memory};
+      set_number(cse, key, number);
+      break;
+    }
+    default:
+      hold(cse, pop->arg, pop->operand, number);
+  }
+}
+
+// a callee may store anywhere in memory and use every temp
+static void forget_for_call(Cse *cse) {
+  cse->memory++;
+  int kept = 0;
+  for (int i = 0; i < cse->nHolders; i++) {
+    if (cse->holders[i].segment != SEGMENT_TEMP) cse->holders[kept++] = cse->holders[i];
+  }
+  cse->nHolders = kept;
+}
+
+static Value pop_value(Cse *cse) {
+  if (cse->depth > 0) return cse->stack[--cse->depth];
+  // pushed before the block
+  Value value = {cse->nextNumber++, -1};
+  return value;
+}
+
+static void push_value(Cse *cse, int number, int start) {
+  Value value = {number, start};
+  cse->stack[cse->depth++] = value;
+}
+
+/*============================ Ranges ============================ */
+
+// Math.multiply and Math.divide depend on nothing but their arguments
+static int call_operation(IrFunction *ir, IrInstr *instr) {
+  if (instr->operand != 2) return OPAQUE;
+  if (ir_is_call(ir, instr, "Math", "multiply")) return MULTIPLY;
+  if (ir_is_call(ir, instr, "Math", "divide")) return DIVIDE;
+  return OPAQUE;
+}
+
+static bool ends_block(IrInstr *instr) {
+  return instr->op == IR_LABEL || instr->op == IR_GOTO || instr->op == IR_IF_GOTO || instr->op == IR_RETURN;
+}
+
+static bool reads_pointer(IrInstr *instr, int pointer) {
+  Segment segment = pointer == 0 ? SEGMENT_THIS : SEGMENT_THAT;
+  if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == segment) return true;
+  return instr->op == IR_PUSH && instr->arg == SEGMENT_POINTER && instr->operand == pointer;
+}
+
+static bool sets_pointer(IrInstr *instr, int pointer) {
+  return instr->op == IR_POP && instr->arg == SEGMENT_POINTER && instr->operand == pointer;
+}
+
+// whether dropping a store to the pointer at from could change what a later
+// command reads; pointer 1 is set again after every label, but the
+// array-offsets pass keeps it across the fall-through of an if-goto
+static bool pointer_dead_after(Cse *cse, int pointer, int from, int to) {
+  IrFunction *ir = cse->ir;
+  for (int i = from; i < to; i++) {
+    if (reads_pointer(&ir->code[i], pointer)) return false;
+    if (sets_pointer(&ir->code[i], pointer)) return true;
+  }
+  if (to < ir->len && ir->code[to].op == IR_RETURN) return true;
+  if (pointer == 1 && to < ir->len && ir->code[to].op == IR_IF_GOTO) {
+    return to + 1 < ir->len && ir->code[to + 1].op == IR_LABEL;
+  }
+  return pointer == 1 || !cse->thisLive;
+}
+
+// the code computes a value and has no effect but on pointers that are set
+// again before they are read
+static bool is_pure(Cse *cse, int start, int end, int to) {
+  IrFunction *ir = cse->ir;
+  for (int i = start; i < end; i++) {
+    IrInstr *instr = &ir->code[i];
+    if (instr->op == IR_CALL && call_operation(ir, instr) == OPAQUE) return false;
+    if (instr->op != IR_POP) continue;
+    if (instr->arg != SEGMENT_POINTER || i + 1 >= end || !reads_pointer(&ir->code[i + 1], instr->operand)) {
+      return false;
+    }
+    if (!pointer_dead_after(cse, instr->operand, end, to)) return false;
+  }
+  return true;
+}
+
+// temp is not in use between from and end, and whatever it holds after end
+// is stored there first
+static bool temp_unused(IrFunction *ir, int temp, int from, int end, int to) {
+  for (int i = from; i < to; i++) {
+    IrInstr *instr = &ir->code[i];
+    if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == SEGMENT_TEMP && instr->operand == temp) {
+      return i >= end && instr->op == IR_POP;
+    }
+  }
+  return true;
+}
+
+static bool calls_between(IrFunction *ir, int from, int to) {
+  for (int i = from; i < to; i++) {
+    if (ir->code[i].op == IR_CALL) return true;
+  }
+  return false;
+}
+
+/*============================ Pass ============================ */
+
+static bool reuse_holder(Cse *cse, Holder *holder, int start, int end) {
+  IrFunction *ir = cse->ir;
+  bool profitable = cse->ctx->pm->level == OPT_OS || ir_cost_of(ir, &ir->code[start], end - start) > COST_PUSH;
+  if (!profitable) return false;
+
+  IrInstr push = ir_instr(IR_PUSH, holder->segment, holder->index, -1);
+  pass_remark(cse->ctx, REMARK_PASSED, ir->lines[start], end - start - 1,
+              "%i commands recompute a value the subroutine already holds", end - start);
+  ir_replace(ir, start, end - start, &push, 1);
+  return true;
+}
+
+static bool keep_in_temp(Cse *cse, Occurrence *first, int start, int end, int to) {
+  IrFunction *ir = cse->ir;
+  // the first result is popped to the temp and pushed back
+  bool profitable = cse->ctx->pm->level == OPT_OS
+                    ? end - start - 1 > 2
+                    : ir_cost_of(ir, &ir->code[start], end - start) - COST_PUSH > COST_POP + COST_PUSH;
+  if (!profitable) return false;
+
+  int temp = -1;
+  for (int t = 1; t < 8 && temp < 0; t++) {
+    if (temp_unused(ir, t, first->end, end, to)) temp = t;
+  }
+  if (temp < 0) {
+    pass_remark(cse->ctx, REMARK_MISSED, ir->lines[start], 0, "no free temp to keep a value computed twice");
+    return false;
+  }
+
+  pass_remark(cse->ctx, REMARK_PASSED, ir->lines[start], end - start - 3,
+              "%i commands repeat the computation on line %i, kept in temp %i", end - start,
+              ir->lines[first->start], temp);
+  IrInstr push = ir_instr(IR_PUSH, SEGMENT_TEMP, temp, -1);
+  ir_replace(ir, start, end - start, &push, 1);
+  IrInstr keep[2] = {ir_instr(IR_POP, SEGMENT_TEMP, temp, -1), push};
+  ir_replace(ir, first->end, 0, keep, 2);
+  return true;
+}
+
+// a value was computed by the commands from start to end
+static bool consider(Cse *cse, int number, int start, int end, int to) {
+  if (start < 0 || end - start < 2 || !is_pure(cse, start, end, to)) return false;
+
+  for (int i = 0; i < cse->nHolders; i++) {
+    Holder *holder = &cse->holders[i];
+    bool stable = holder->segment == SEGMENT_LOCAL || holder->segment == SEGMENT_ARG || holder->segment == SEGMENT_TEMP;
+    if (stable && holder->number == number) return reuse_holder(cse, holder, start, end);
+  }
+
+  for (int i = cse->nSeen - 1; i >= 0; i--) {
+    Occurrence *first = &cse->seen[i];
+    if (first->number != number || first->end > start) continue;
+    // a callee may use the temp
+    if (calls_between(cse->ir, first->end, start)) break;
+    return keep_in_temp(cse, first, start, end, to);
+  }
+
+  Occurrence occurrence = {number, start, end};
+  cse->seen[cse->nSeen++] = occurrence;
+  return false;
+}
+
+// numbers the commands from from up to the end of the block at to; true as
+// soon as it has changed the code
+static bool number_block(Cse *cse, int from, int to) {
+  IrFunction *ir = cse->ir;
+  cse->nKeys = 0;
+  cse->nHolders = 0;
+  cse->depth = 0;
+  cse->nSeen = 0;
+  cse->pointerStart[0] = cse->pointerStart[1] = -1;
+
+  for (int i = from; i < to; i++) {
+    IrInstr *instr = &ir->code[i];
+    switch (instr->op) {
+      case IR_PUSH: {
+        int start = i;
+        // an element read starts with the code that set the pointer
+        int pointer = instr->arg == SEGMENT_THIS ? 0 : instr->arg == SEGMENT_THAT ? 1 : -1;
+        if (pointer >= 0 && i > from && sets_pointer(&ir->code[i - 1], pointer)) {
+          start = cse->pointerStart[pointer];
+        }
+        int number = load(cse, instr);
+        push_value(cse, number, start);
+        if (consider(cse, number, start, i + 1, to)) return true;
+        break;
+      }
+      case IR_POP: {
+        Value value = pop_value(cse);
+        if (instr->arg == SEGMENT_POINTER) cse->pointerStart[instr->operand] = value.start;
+        store(cse, instr, value.number);
+        break;
+      }
+      case IR_ARITHMETIC: case IR_CALL: {
+        int op = instr->op == IR_CALL ? call_operation(ir, instr) : (int) instr->arg;
+        if (instr->op == IR_CALL) {
+          forget_for_call(cse);
+        }
+        if (op == OPAQUE) {
+          for (int n = 0; n < instr->operand; n++) pop_value(cse);
+          push_value(cse, cse->nextNumber++, -1);
+          break;
+        }
+
+        bool unary = op == NEG || op == NOT;
+        Value right = pop_value(cse);
+        Value left = unary ? right : pop_value(cse);
+        Key key = {KEY_OPERATION, op, left.number, unary ? -1 : right.number, 0};
+        bool commutative = op == ADD || op == AND || op == OR || op == EQ || op == MULTIPLY;
+        if (commutative && key.b > key.c) {
+          int swap = key.b;
+          key.b = key.c;
+          key.c = swap;
+        }
+        int start = left.start < 0 || right.start < 0 ? -1 : left.start;
+        int number = number_of(cse, key);
+        push_value(cse, number, start);
+        if (consider(cse, number, start, i + 1, to)) return true;
+        break;
+      }
+      default:
+        break;
+    }
+  }
+  return false;
+}
+
+int eliminate_common_subexpressions(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  Cse cse = {ctx, ir, false};
+  for (int i = 1; i < ir->len; i++) {
+    if (reads_pointer(&ir->code[i], 0)) cse.thisLive = true;
+  }
+
+  int capacity = MAX_ENTRIES(ir->len);
+  cse.keys = malloc(sizeof(Key) * capacity);
+  cse.numbers = malloc(sizeof(int) * capacity);
+  cse.holders = malloc(sizeof(Holder) * capacity);
+  cse.stack = malloc(sizeof(Value) * capacity);
+  cse.seen = malloc(sizeof(Occurrence) * capacity);
+
+  int changes = 0;
+  int from = 1;
+  while (from < ir->len) {
+    int to = from;
+    while (to < ir->len && !ends_block(&ir->code[to])) to++;
+    // a block that was changed is numbered again
+    if (number_block(&cse, from, to)) {
+      changes++;
+      continue;
+    }
+    from = to + 1;
+  }
+
+  free(cse.keys);
+  free(cse.numbers);
+  free(cse.holders);
+  free(cse.stack);
+  free(cse.seen);
+  return changes;
+}
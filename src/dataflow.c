@@ -0,0 +1,638 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dataflow.h"
+#include "passes.h"
+
+#define WORDS(bits) (((bits) + 63) / 64)
+
+static bool test_bit(uint64_t *set, int bit) {
+  return (set[bit / 64] >> (bit % 64)) & 1;
+}
+
+static void set_bit(uint64_t *set, int bit) {
+  set[bit / 64] |= (uint64_t) 1 << (bit % 64);
+}
+
+static bool ends_block(IrInstr *instr) {
+  return instr->op == IR_GOTO || instr->op == IR_IF_GOTO || instr->op == IR_RETURN;
+}
+
+int dataflow_variable(Dataflow *df, IrInstr *instr) {
+  if (instr->op != IR_PUSH && instr->op != IR_POP) return -1;
+  if (instr->arg == SEGMENT_LOCAL) return instr->operand;
+  if (instr->arg == SEGMENT_ARG) return df->nLocals + instr->operand;
+  return -1;
+}
+
+static bool is_store(Dataflow *df, IrInstr *instr) {
+  return instr->op == IR_POP && dataflow_variable(df, instr) != -1;
+}
+
+static bool is_load(Dataflow *df, IrInstr *instr) {
+  return instr->op == IR_PUSH && dataflow_variable(df, instr) != -1;
+}
+
+/*============================ Graph ============================ */
+
+static void count_variables(Dataflow *df) {
+  IrFunction *ir = df->ir;
+  df->nLocals = ir->code[0].operand;
+  df->nArgs = 0;
+  for (int i = 1; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if (instr->op != IR_PUSH && instr->op != IR_POP) continue;
+    if (instr->arg == SEGMENT_LOCAL && instr->operand >= df->nLocals) df->nLocals = instr->operand + 1;
+    if (instr->arg == SEGMENT_ARG && instr->operand >= df->nArgs) df->nArgs = instr->operand + 1;
+  }
+  df->nVars = df->nLocals + df->nArgs;
+  df->varWords = WORDS(df->nVars);
+}
+
+static void add_block(Dataflow *df, int start, int end) {
+  Block *block = &df->blocks[df->nBlocks];
+  memset(block, 0, sizeof(Block));
+  block->start = start;
+  block->end = end;
+  block->idom = -1;
+  block->rpo = -1;
+  for (int i = start; i < end; i++) {
+    df->blockOf[i] = df->nBlocks;
+  }
+  df->nBlocks++;
+}
+
+// blocks begin at labels and after branches and returns
+static void split_blocks(Dataflow *df) {
+  IrFunction *ir = df->ir;
+  df->blocks = malloc(sizeof(Block) * (ir->len + 1));
+  df->blockOf = malloc(sizeof(int) * ir->len);
+  df->blockOf[0] = 0;
+  df->nBlocks = 0;
+  add_block(df, 1, 1);
+
+  int start = 1;
+  for (int i = 1; i < ir->len; i++) {
+    if (ir->code[i].op == IR_LABEL && i > start) {
+      add_block(df, start, i);
+      start = i;
+    }
+    if (ends_block(&ir->code[i])) {
+      add_block(df, start, i + 1);
+      start = i + 1;
+    }
+  }
+  if (start < ir->len) add_block(df, start, ir->len);
+}
+
+static void link_blocks(Dataflow *df) {
+  IrFunction *ir = df->ir;
+  int *labelBlock = malloc(sizeof(int) * (ir->nNames + 1));
+  for (int i = 0; i < ir->nNames; i++) {
+    labelBlock[i] = -1;
+  }
+  for (int b = 1; b < df->nBlocks; b++) {
+    IrInstr *first = &ir->code[df->blocks[b].start];
+    if (first->op == IR_LABEL) labelBlock[first->name] = b;
+  }
+
+  for (int b = 0; b < df->nBlocks; b++) {
+    Block *block = &df->blocks[b];
+    IrInstr *last = block->end > block->start ? &ir->code[block->end - 1] : NULL;
+    bool fallsThrough = last == NULL || (last->op != IR_GOTO && last->op != IR_RETURN);
+
+    if (last != NULL && (last->op == IR_GOTO || last->op == IR_IF_GOTO) && labelBlock[last->name] != -1) {
+      block->succs[block->nSuccs++] = labelBlock[last->name];
+    }
+    if (fallsThrough && b + 1 < df->nBlocks) {
+      block->succs[block->nSuccs++] = b + 1;
+    }
+  }
+  free(labelBlock);
+}
+
+// reverse postorder of a depth-first walk from the entry
+static void order_blocks(Dataflow *df) {
+  int *stack = malloc(sizeof(int) * df->nBlocks);
+  int *next = calloc(df->nBlocks, sizeof(int));
+  bool *seen = calloc(df->nBlocks, sizeof(bool));
+  int *post = malloc(sizeof(int) * df->nBlocks);
+  int nPost = 0;
+  int depth = 0;
+
+  stack[depth++] = 0;
+  seen[0] = true;
+  while (depth > 0) {
+    Block *block = &df->blocks[stack[depth - 1]];
+    int *succ = &next[stack[depth - 1]];
+    if (*succ < block->nSuccs) {
+      int s = block->succs[(*succ)++];
+      if (!seen[s]) {
+        seen[s] = true;
+        stack[depth++] = s;
+      }
+    } else {
+      post[nPost++] = stack[--depth];
+    }
+  }
+
+  df->order = malloc(sizeof(int) * df->nBlocks);
+  df->nOrder = nPost;
+  for (int i = 0; i < nPost; i++) {
+    df->order[i] = post[nPost - 1 - i];
+    df->blocks[df->order[i]].rpo = i;
+  }
+
+  for (int i = 0; i < nPost; i++) {
+    Block *block = &df->blocks[df->order[i]];
+    for (int s = 0; s < block->nSuccs; s++) {
+      df->blocks[block->succs[s]].nPreds++;
+    }
+  }
+  for (int b = 0; b < df->nBlocks; b++) {
+    df->blocks[b].preds = malloc(sizeof(int) * (df->blocks[b].nPreds + 1));
+    df->blocks[b].nPreds = 0;
+  }
+  for (int i = 0; i < nPost; i++) {
+    Block *block = &df->blocks[df->order[i]];
+    for (int s = 0; s < block->nSuccs; s++) {
+      Block *succ = &df->blocks[block->succs[s]];
+      succ->preds[succ->nPreds++] = df->order[i];
+    }
+  }
+
+  free(stack);
+  free(next);
+  free(seen);
+  free(post);
+}
+
+/*============================ Dominators ============================ */
+
+static int intersect(Dataflow *df, int a, int b) {
+  while (a != b) {
+    while (df->blocks[a].rpo > df->blocks[b].rpo) a = df->blocks[a].idom;
+    while (df->blocks[b].rpo > df->blocks[a].rpo) b = df->blocks[b].idom;
+  }
+  return a;
+}
+
+// Cooper, Harvey and Kennedy's iteration over the reverse postorder; the
+// entry is its own dominator until the end
+static void find_dominators(Dataflow *df) {
+  df->blocks[0].idom = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 1; i < df->nOrder; i++) {
+      Block *block = &df->blocks[df->order[i]];
+      int idom = -1;
+      for (int p = 0; p < block->nPreds; p++) {
+        int pred = block->preds[p];
+        if (df->blocks[pred].idom == -1) continue;
+        idom = idom == -1 ? pred : intersect(df, pred, idom);
+      }
+      if (block->idom != idom) {
+        block->idom = idom;
+        changed = true;
+      }
+    }
+  }
+
+  for (int b = 0; b < df->nBlocks; b++) {
+    df->blocks[b].frontier = malloc(sizeof(int) * 4);
+  }
+  int *capacity = malloc(sizeof(int) * df->nBlocks);
+  for (int b = 0; b < df->nBlocks; b++) {
+    capacity[b] = 4;
+  }
+  for (int b = 0; b < df->nBlocks; b++) {
+    Block *block = &df->blocks[b];
+    if (block->nPreds < 2) continue;
+    for (int p = 0; p < block->nPreds; p++) {
+      for (int runner = block->preds[p]; runner != block->idom; runner = df->blocks[runner].idom) {
+        Block *r = &df->blocks[runner];
+        if (r->nFrontier > 0 && r->frontier[r->nFrontier - 1] == b) break;
+        if (r->nFrontier == capacity[runner]) {
+          capacity[runner] *= 2;
+          r->frontier = realloc(r->frontier, sizeof(int) * capacity[runner]);
+        }
+        r->frontier[r->nFrontier++] = b;
+      }
+    }
+  }
+  free(capacity);
+  df->blocks[0].idom = -1;
+}
+
+bool dominates(Dataflow *df, int a, int b) {
+  if (df->blocks[b].rpo == -1) return false;
+  while (b != a && b > 0) {
+    b = df->blocks[b].idom;
+  }
+  return b == a;
+}
+
+/*============================ Liveness ============================ */
+
+static void find_liveness(Dataflow *df) {
+  int words = df->varWords;
+  df->liveIn = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  df->liveOut = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  uint64_t *uses = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  uint64_t *defs = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+
+  for (int b = 0; b < df->nBlocks; b++) {
+    Block *block = &df->blocks[b];
+    for (int i = block->start; i < block->end; i++) {
+      IrInstr *instr = &df->ir->code[i];
+      int var = dataflow_variable(df, instr);
+      if (var == -1) continue;
+      if (instr->op == IR_PUSH && !test_bit(&defs[b * words], var)) set_bit(&uses[b * words], var);
+      if (instr->op == IR_POP) set_bit(&defs[b * words], var);
+    }
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = df->nOrder - 1; i >= 0; i--) {
+      int b = df->order[i];
+      Block *block = &df->blocks[b];
+      uint64_t *in = &df->liveIn[b * words];
+      uint64_t *out = &df->liveOut[b * words];
+      for (int s = 0; s < block->nSuccs; s++) {
+        uint64_t *succIn = &df->liveIn[block->succs[s] * words];
+        for (int w = 0; w < words; w++) {
+          out[w] |= succIn[w];
+        }
+      }
+      for (int w = 0; w < words; w++) {
+        uint64_t live = uses[b * words + w] | (out[w] & ~defs[b * words + w]);
+        if (live != in[w]) {
+          in[w] = live;
+          changed = true;
+        }
+      }
+    }
+  }
+  free(uses);
+  free(defs);
+}
+
+// whether var may be read after command before it is stored again
+bool live_after(Dataflow *df, int command, int var) {
+  int b = df->blockOf[command];
+  Block *block = &df->blocks[b];
+  for (int i = command + 1; i < block->end; i++) {
+    IrInstr *instr = &df->ir->code[i];
+    if (dataflow_variable(df, instr) != var) continue;
+    return instr->op == IR_PUSH;
+  }
+  return test_bit(&df->liveOut[b * df->varWords], var);
+}
+
+/*============================ Reaching definitions ============================ */
+
+static void find_reaching_definitions(Dataflow *df) {
+  IrFunction *ir = df->ir;
+  df->nDefs = df->nVars;
+  for (int i = 1; i < ir->len; i++) {
+    if (is_store(df, &ir->code[i])) df->nDefs++;
+  }
+  df->defWords = WORDS(df->nDefs);
+  df->defCommand = malloc(sizeof(int) * (df->nDefs + 1));
+  df->defVar = malloc(sizeof(int) * (df->nDefs + 1));
+  for (int v = 0; v < df->nVars; v++) {
+    df->defCommand[v] = ENTRY_DEFINITION;
+    df->defVar[v] = v;
+  }
+
+  int words = df->defWords;
+  uint64_t *ofVar = calloc((size_t) df->nVars * words + 1, sizeof(uint64_t));
+  for (int v = 0; v < df->nVars; v++) {
+    set_bit(&ofVar[v * words], v);
+  }
+  for (int i = 1, d = df->nVars; i < ir->len; i++) {
+    if (!is_store(df, &ir->code[i])) continue;
+    df->defCommand[d] = i;
+    df->defVar[d] = dataflow_variable(df, &ir->code[i]);
+    set_bit(&ofVar[df->defVar[d] * words], d);
+    d++;
+  }
+
+  // a block generates the last definition of each variable it stores and
+  // kills all the others of those variables
+  uint64_t *gen = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  uint64_t *kill = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  for (int d = df->nVars; d < df->nDefs; d++) {
+    int b = df->blockOf[df->defCommand[d]];
+    uint64_t *blockKill = &kill[b * words];
+    uint64_t *blockGen = &gen[b * words];
+    for (int w = 0; w < words; w++) {
+      blockKill[w] |= ofVar[df->defVar[d] * words + w];
+      blockGen[w] &= ~ofVar[df->defVar[d] * words + w];
+    }
+    set_bit(blockGen, d);
+  }
+
+  df->reachIn = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  uint64_t *reachOut = calloc((size_t) df->nBlocks * words + 1, sizeof(uint64_t));
+  for (int v = 0; v < df->nVars; v++) {
+    set_bit(df->reachIn, v);
+  }
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = 0; i < df->nOrder; i++) {
+      int b = df->order[i];
+      Block *block = &df->blocks[b];
+      uint64_t *in = &df->reachIn[b * words];
+      for (int p = 0; p < block->nPreds; p++) {
+        uint64_t *predOut = &reachOut[block->preds[p] * words];
+        for (int w = 0; w < words; w++) {
+          in[w] |= predOut[w];
+        }
+      }
+      for (int w = 0; w < words; w++) {
+        uint64_t out = gen[b * words + w] | (in[w] & ~kill[b * words + w]);
+        if (out != reachOut[b * words + w]) {
+          reachOut[b * words + w] = out;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  free(ofVar);
+  free(gen);
+  free(kill);
+  free(reachOut);
+}
+
+// whether definition def may give its variable the value it has just
+// before command
+bool definition_reaches(Dataflow *df, int def, int command) {
+  int var = df->defVar[def];
+  int b = df->blockOf[command];
+  for (int i = command - 1; i >= df->blocks[b].start; i--) {
+    IrInstr *instr = &df->ir->code[i];
+    if (instr->op == IR_POP && dataflow_variable(df, instr) == var) return df->defCommand[def] == i;
+  }
+  return test_bit(&df->reachIn[b * df->defWords], def);
+}
+
+/*============================ SSA ============================ */
+
+static int new_value(Dataflow *df, int var, int command, int block) {
+  SsaValue *value = &df->values[df->nValues];
+  value->var = var;
+  value->command = command;
+  value->block = block;
+  return df->nValues++;
+}
+
+// a phi for every variable at the iterated dominance frontier of the blocks
+// that store it
+static void place_phis(Dataflow *df, int *phiValue) {
+  IrFunction *ir = df->ir;
+  int *work = malloc(sizeof(int) * (df->nBlocks + ir->len));
+  int *queued = malloc(sizeof(int) * df->nBlocks);
+  for (int b = 0; b < df->nBlocks; b++) {
+    queued[b] = -1;
+  }
+
+  for (int var = 0; var < df->nVars; var++) {
+    int nWork = 0;
+    for (int i = 1; i < ir->len; i++) {
+      int b = df->blockOf[i];
+      if (ir->code[i].op == IR_POP && dataflow_variable(df, &ir->code[i]) == var &&
+          queued[b] != var && df->blocks[b].rpo != -1) {
+        queued[b] = var;
+        work[nWork++] = b;
+      }
+    }
+
+    while (nWork > 0) {
+      Block *block = &df->blocks[work[--nWork]];
+      for (int f = 0; f < block->nFrontier; f++) {
+        int join = block->frontier[f];
+        if (phiValue[join * df->nVars + var] != -1) continue;
+        phiValue[join * df->nVars + var] = new_value(df, var, PHI_DEFINITION, join);
+        df->nPhis++;
+        if (queued[join] != var) {
+          queued[join] = var;
+          work[nWork++] = join;
+        }
+      }
+    }
+  }
+  free(work);
+  free(queued);
+}
+
+// Without a phi, a variable holds where a block starts what it held where
+// its immediate dominator ended, so the values are named block by block in
+// reverse postorder.
+static void build_ssa(Dataflow *df) {
+  IrFunction *ir = df->ir;
+  int nVars = df->nVars;
+  size_t table = (size_t) df->nBlocks * nVars + 1;
+
+  df->values = malloc(sizeof(SsaValue) * (nVars + ir->len + table));
+  df->nValues = 0;
+  df->nPhis = 0;
+  for (int v = 0; v < nVars; v++) {
+    new_value(df, v, ENTRY_DEFINITION, 0);
+  }
+
+  int *phiValue = malloc(sizeof(int) * table);
+  for (size_t i = 0; i < table; i++) {
+    phiValue[i] = -1;
+  }
+  place_phis(df, phiValue);
+
+  df->valueOf = malloc(sizeof(int) * ir->len);
+  df->valueIn = malloc(sizeof(int) * table);
+  df->valueOut = malloc(sizeof(int) * table);
+  for (int i = 0; i < ir->len; i++) {
+    df->valueOf[i] = -1;
+  }
+  for (size_t i = 0; i < table; i++) {
+    df->valueIn[i] = df->valueOut[i] = -1;
+  }
+
+  for (int o = 0; o < df->nOrder; o++) {
+    int b = df->order[o];
+    Block *block = &df->blocks[b];
+    int *in = &df->valueIn[b * nVars];
+    int *out = &df->valueOut[b * nVars];
+    for (int v = 0; v < nVars; v++) {
+      if (phiValue[b * nVars + v] != -1) {
+        in[v] = phiValue[b * nVars + v];
+      } else {
+        in[v] = b == 0 ? v : df->valueOut[block->idom * nVars + v];
+      }
+      out[v] = in[v];
+    }
+    for (int i = block->start; i < block->end; i++) {
+      IrInstr *instr = &ir->code[i];
+      int var = dataflow_variable(df, instr);
+      if (var == -1) continue;
+      if (instr->op == IR_PUSH) {
+        df->valueOf[i] = out[var];
+      } else {
+        out[var] = df->valueOf[i] = new_value(df, var, i, b);
+      }
+    }
+  }
+
+  df->phis = malloc(sizeof(Phi) * (df->nPhis + 1));
+  int nPhis = 0;
+  for (int o = 0; o < df->nOrder; o++) {
+    int b = df->order[o];
+    Block *block = &df->blocks[b];
+    for (int v = 0; v < nVars; v++) {
+      if (phiValue[b * nVars + v] == -1) continue;
+      Phi *phi = &df->phis[nPhis++];
+      phi->block = b;
+      phi->var = v;
+      phi->value = phiValue[b * nVars + v];
+      phi->args = malloc(sizeof(int) * (block->nPreds + 1));
+      for (int p = 0; p < block->nPreds; p++) {
+        phi->args[p] = df->valueOut[block->preds[p] * nVars + v];
+      }
+    }
+  }
+  df->nPhis = nPhis;
+  free(phiValue);
+}
+
+// the value var holds just before command, -1 if the command is unreachable
+int ssa_value_at(Dataflow *df, int command, int var) {
+  int b = df->blockOf[command];
+  for (int i = command - 1; i >= df->blocks[b].start; i--) {
+    IrInstr *instr = &df->ir->code[i];
+    if (instr->op == IR_POP && dataflow_variable(df, instr) == var) return df->valueOf[i];
+  }
+  return df->valueIn[b * df->nVars + var];
+}
+
+/*============================ Framework ============================ */
+
+Dataflow *new_dataflow(IrFunction *ir) {
+  Dataflow *df = calloc(1, sizeof(Dataflow));
+  df->ir = ir;
+  count_variables(df);
+  split_blocks(df);
+  link_blocks(df);
+  order_blocks(df);
+  find_dominators(df);
+  find_liveness(df);
+  find_reaching_definitions(df);
+  build_ssa(df);
+  return df;
+}
+
+void free_dataflow(Dataflow *df) {
+  for (int b = 0; b < df->nBlocks; b++) {
+    free(df->blocks[b].preds);
+    free(df->blocks[b].frontier);
+  }
+  for (int i = 0; i < df->nPhis; i++) {
+    free(df->phis[i].args);
+  }
+  free(df->blocks);
+  free(df->blockOf);
+  free(df->order);
+  free(df->liveIn);
+  free(df->liveOut);
+  free(df->defCommand);
+  free(df->defVar);
+  free(df->reachIn);
+  free(df->values);
+  free(df->valueOf);
+  free(df->valueIn);
+  free(df->valueOut);
+  free(df->phis);
+  free(df);
+}
+
+/*============================ Names ============================ */
+
+// the declared name of a variable, NULL for locals the compiler added
+static char *variable_name(Function *func, Kind kind, int index) {
+  Map *table = func->lTable->table;
+  for (int i = 0; i < table->keys->len; i++) {
+    Properties *props = vec_get(table->vals, i);
+    if (props->kind == kind && props->index == index) return vec_get(table->keys, i);
+  }
+  return NULL;
+}
+
+// the name of var for remarks, e.g. "count" or "local 4"
+void describe_variable(Dataflow *df, Function *func, int var, char *buf, int size) {
+  bool local = var < df->nLocals;
+  int index = local ? var : var - df->nLocals;
+  char *name = variable_name(func, local ? KIND_VAR : KIND_ARG, index);
+  if (name != NULL) {
+    snprintf(buf, size, "%s", name);
+  } else {
+    snprintf(buf, size, "%s %i", local ? "local" : "argument", index);
+  }
+}
+
+/*============================ Pass ============================ */
+
+// Reports declared locals that may be read before anything is stored to
+// them, so they hold the 0 the VM starts them with, and variables that are
+// never read.
+int analyze_dataflow(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  Dataflow *df = new_dataflow(ir);
+  int declared = varCount(ctx->func->lTable, KIND_VAR);
+  int facts = 0;
+
+  uint64_t *read = calloc(df->varWords + 1, sizeof(uint64_t));
+  uint64_t *reported = calloc(df->varWords + 1, sizeof(uint64_t));
+  for (int i = 1; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if (!is_load(df, instr)) continue;
+    int var = dataflow_variable(df, instr);
+    set_bit(read, var);
+    if (var >= declared || test_bit(reported, var) || df->blocks[df->blockOf[i]].rpo == -1 ||
+        !definition_reaches(df, var, i)) {
+      continue;
+    }
+
+    set_bit(reported, var);
+    facts++;
+    char *name = variable_name(ctx->func, KIND_VAR, var);
+    pass_remark(ctx, REMARK_ANALYSIS, ir->lines[i], 0, "%s may be read before it is assigned and then holds 0",
+                name != NULL ? name : "a local");
+  }
+
+  for (int var = 0; var < df->nVars; var++) {
+    if (test_bit(read, var)) continue;
+    Kind kind = var < df->nLocals ? KIND_VAR : KIND_ARG;
+    char *name = variable_name(ctx->func, kind, kind == KIND_VAR ? var : var - df->nLocals);
+    if (name == NULL) continue;
+    facts++;
+    pass_remark(ctx, REMARK_ANALYSIS, ir->lines[0], 0, "%s %s is never read",
+                kind == KIND_VAR ? "local" : "argument", name);
+  }
+  // unread arguments past the last one the code refers to
+  for (int arg = df->nArgs; arg < varCount(ctx->func->lTable, KIND_ARG); arg++) {
+    char *name = variable_name(ctx->func, KIND_ARG, arg);
+    if (name == NULL) continue;
+    facts++;
+    pass_remark(ctx, REMARK_ANALYSIS, ir->lines[0], 0, "argument %s is never read", name);
+  }
+
+  free(read);
+  free(reported);
+  free_dataflow(df);
+  return facts;
+}
@@ -0,0 +1,101 @@
+
+#ifndef COMPILER_DATAFLOW_H
+#define COMPILER_DATAFLOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm_ir.h"
+#include "parser.h"
+
+// The control-flow graph of one subroutine and what is known about its
+// locals and arguments: dominators, liveness, reaching definitions and an
+// SSA numbering of their values. Variable v is local v for v < nLocals and
+// argument v - nLocals after that. The facts describe the IR as it was when
+// they were computed; a pass that rewrites the code computes them again.
+
+// the SSA value a variable has when the subroutine starts is numbered like
+// the variable and defined by no command
+#define ENTRY_DEFINITION (-1)
+#define PHI_DEFINITION (-2)
+
+typedef struct {
+  // commands start to end - 1
+  int start;
+  int end;
+  int succs[2];
+  int nSuccs;
+  // reachable predecessors only
+  int *preds;
+  int nPreds;
+  // -1 for the entry and for unreachable blocks
+  int idom;
+  // position in reverse postorder, -1 if unreachable
+  int rpo;
+  int *frontier;
+  int nFrontier;
+} Block;
+
+typedef struct {
+  int var;
+  // the command that pops it, ENTRY_DEFINITION or PHI_DEFINITION
+  int command;
+  int block;
+} SsaValue;
+
+// the value of var where the paths into block join; args follow block->preds
+typedef struct {
+  int block;
+  int var;
+  int value;
+  int *args;
+} Phi;
+
+typedef struct {
+  IrFunction *ir;
+  // block 0 is an empty entry that no branch leads to
+  Block *blocks;
+  int nBlocks;
+  int *blockOf;
+  // the reachable blocks in reverse postorder
+  int *order;
+  int nOrder;
+
+  int nLocals;
+  int nArgs;
+  int nVars;
+  int varWords;
+  // bitsets over variables, varWords per block
+  uint64_t *liveIn;
+  uint64_t *liveOut;
+
+  // definition v < nVars is the entry value of variable v, the others are
+  // the pops to variables in code order
+  int nDefs;
+  int defWords;
+  int *defCommand;
+  int *defVar;
+  // bitsets over definitions, defWords per block
+  uint64_t *reachIn;
+
+  SsaValue *values;
+  int nValues;
+  // for each command, the value a pop defines or a push reads, else -1
+  int *valueOf;
+  // the value of each variable where a block starts and where it ends,
+  // nVars per block
+  int *valueIn;
+  int *valueOut;
+  Phi *phis;
+  int nPhis;
+} Dataflow;
+
+Dataflow *new_dataflow(IrFunction *ir);
+void free_dataflow(Dataflow *df);
+int dataflow_variable(Dataflow *df, IrInstr *instr);
+bool dominates(Dataflow *df, int a, int b);
+bool live_after(Dataflow *df, int command, int var);
+bool definition_reaches(Dataflow *df, int def, int command);
+int ssa_value_at(Dataflow *df, int command, int var);
+void describe_variable(Dataflow *df, Function *func, int var, char *buf, int size);
+
+#endif //COMPILER_DATAFLOW_H
@@ -0,0 +1,272 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "func_cache.h"
+#include "io_batch.h"
+
+#define FUNC_CACHE_VERSION 1
+
+static uint64_t hash_expression(uint64_t hash, Expression *expr);
+static uint64_t hash_statements(uint64_t hash, Vector *stmts);
+
+/*============================ Keys ============================ */
+
+static uint64_t mix(uint64_t hash, uint64_t value) {
+  return hash_bytes((char *) &value, sizeof(value)) ^ (hash * 1099511628211ULL);
+}
+
+static uint64_t mix_str(uint64_t hash, char *str) {
+  if (str == NULL) return mix(hash, 0);
+  return mix(hash, hash_bytes(str, strlen(str)));
+}
+
+static uint64_t hash_symbol_table(uint64_t hash, SymbolTable *table) {
+  Vector *keys = table->table->keys;
+  for (int i = 0; i < keys->len; i++) {
+    Properties *props = vec_get(table->table->vals, i);
+    hash = mix_str(hash, vec_get(keys, i));
+    hash = mix_str(hash, props->type);
+    hash = mix(hash, props->kind);
+    hash = mix(hash, props->index);
+  }
+  return mix(hash, keys->len);
+}
+
+static uint64_t hash_call(uint64_t hash, SubroutineCall *call) {
+  hash = mix(hash, call->type);
+  if (call->type == TARGET_SUB_CALL) hash = mix_str(hash, call->target);
+  hash = mix_str(hash, call->subroutineName);
+
+  Vector *exprs = call->exprList != NULL ? call->exprList->expressions : NULL;
+  for (int i = 0; exprs != NULL && i < exprs->len; i++) {
+    hash = hash_expression(hash, vec_get(exprs, i));
+  }
+  return mix(hash, exprs != NULL ? exprs->len : 0);
+}
+
+static uint64_t hash_term(uint64_t hash, Term *term) {
+  hash = mix(hash, term->type);
+  switch (term->type) {
+    case TERM_INT:
+      return mix_str(hash, term->integer);
+    case TERM_STR:
+      return mix_str(hash, term->str);
+    case TERM_VAR:
+      return mix_str(hash, term->varName);
+    case TERM_KEYWORD:
+      return mix(hash, term->kConst);
+    case TERM_ARRAY:
+      return hash_expression(mix_str(hash, term->array->varName), term->array->expr);
+    case TERM_SUB_CALL:
+      return hash_call(hash, term->subCall);
+    case TERM_EXPR_PARENS:
+      return hash_expression(hash, term->expr);
+    case TERM_TERM_PAIR:
+      return hash_term(mix(hash, term->termPair->op), term->termPair->term);
+  }
+  return hash;
+}
+
+static uint64_t hash_expression(uint64_t hash, Expression *expr) {
+  if (expr == NULL) return mix(hash, 0);
+
+  hash = hash_term(hash, expr->firstTerm);
+  for (int i = 0; expr->termPairs != NULL && i < expr->termPairs->len; i++) {
+    TermPair *pair = vec_get(expr->termPairs, i);
+    hash = hash_term(mix(hash, pair->op), pair->term);
+  }
+  return mix(hash, expr->termPairs != NULL ? expr->termPairs->len : 0);
+}
+
+static uint64_t hash_statements(uint64_t hash, Vector *stmts) {
+  if (stmts == NULL) return mix(hash, 0);
+
+  for (int i = 0; i < stmts->len; i++) {
+    Statement *stmt = vec_get(stmts, i);
+    hash = mix(hash, stmt->type);
+    switch (stmt->type) {
+      case LET_STMT:
+        hash = mix(mix_str(hash, stmt->letStmt->name), stmt->letStmt->type);
+        hash = hash_expression(hash, stmt->letStmt->firstExpr);
+        hash = hash_expression(hash, stmt->letStmt->secondExpr);
+        break;
+      case IF_STMT:
+        hash = hash_expression(hash, stmt->ifStmt->expr);
+        hash = hash_statements(hash, stmt->ifStmt->ifStmts);
+        hash = hash_statements(hash, stmt->ifStmt->elseStmts);
+        break;
+      case WHILE_STMT:
+        hash = hash_expression(hash, stmt->whileStmt->expr);
+        hash = hash_statements(hash, stmt->whileStmt->stmts);
+        break;
+      case DO_STMT:
+        hash = hash_call(hash, stmt->doStmt->call);
+        break;
+      case RETURN_STMT:
+        hash = hash_expression(hash, stmt->retStmt->expr);
+        break;
+    }
+  }
+  return mix(hash, stmts->len + 1);
+}
+
+// everything the generated code of a subroutine depends on
+uint64_t function_key(Class *class, Function *func, uint64_t config) {
+  uint64_t hash = mix(FUNC_CACHE_VERSION, config);
+  hash = mix_str(hash, class->name);
+  hash = hash_symbol_table(hash, class->gTable);
+  hash = mix_str(hash, func->name);
+  hash = mix(hash, func->funcKind);
+  hash = mix_str(hash, func->returnType);
+  hash = hash_symbol_table(hash, func->lTable);
+  return hash_statements(hash, func->statements);
+}
+
+/*============================ Table ============================ */
+
+FuncCache *new_func_cache(void) {
+  FuncCache *cache = malloc(sizeof(FuncCache));
+  cache->capacity = 64;
+  cache->len = 0;
+  cache->entries = calloc(cache->capacity, sizeof(FuncCacheEntry));
+  return cache;
+}
+
+// open addressing; a slot without data is free
+static FuncCacheEntry *find_slot(FuncCacheEntry *entries, int capacity, uint64_t key) {
+  int i = (int) (key & (capacity - 1));
+  while (entries[i].data != NULL && entries[i].key != key) {
+    i = (i + 1) & (capacity - 1);
+  }
+  return &entries[i];
+}
+
+FuncCacheEntry *func_cache_get(FuncCache *cache, uint64_t key) {
+  FuncCacheEntry *entry = find_slot(cache->entries, cache->capacity, key);
+  if (entry->data == NULL) return NULL;
+  entry->used = true;
+  return entry;
+}
+
+static void rehash(FuncCache *cache, int capacity, bool onlyUsed) {
+  FuncCacheEntry *entries = calloc(capacity, sizeof(FuncCacheEntry));
+  int len = 0;
+
+  for (int i = 0; i < cache->capacity; i++) {
+    FuncCacheEntry *entry = &cache->entries[i];
+    if (entry->data == NULL) continue;
+    if (onlyUsed && !entry->used) {
+      free(entry->data);
+      continue;
+    }
+    *find_slot(entries, capacity, entry->key) = *entry;
+    len++;
+  }
+
+  free(cache->entries);
+  cache->entries = entries;
+  cache->capacity = capacity;
+  cache->len = len;
+}
+
+// the cache keeps its own copy of the data
+void func_cache_put(FuncCache *cache, uint64_t key, char *data, size_t len, long nCommands) {
+  if ((cache->len + 1) * 2 > cache->capacity) {
+    rehash(cache, cache->capacity * 2, false);
+  }
+
+  FuncCacheEntry *entry = find_slot(cache->entries, cache->capacity, key);
+  if (entry->data != NULL) {
+    free(entry->data);
+  } else {
+    cache->len++;
+  }
+
+  entry->key = key;
+  entry->data = malloc(len + 1);
+  memcpy(entry->data, data, len);
+  entry->len = len;
+  entry->nCommands = nCommands;
+  entry->used = true;
+}
+
+// drops the subroutines that were not part of the last build and starts a new one
+void func_cache_prune(FuncCache *cache) {
+  rehash(cache, cache->capacity, true);
+  for (int i = 0; i < cache->capacity; i++) {
+    cache->entries[i].used = false;
+  }
+}
+
+/*============================ Files ============================ */
+
+// "JFNC" version count { key nCommands len data }*
+char *serialize_func_cache(FuncCache *cache, size_t *len) {
+  StringBuilder *sb = new_sb();
+  uint64_t header[3] = {0, FUNC_CACHE_VERSION, 0};
+  memcpy(&header[0], "JFNC\0\0\0\0", 8);
+
+  for (int i = 0; i < cache->capacity; i++) {
+    if (cache->entries[i].data != NULL) header[2]++;
+  }
+  sb_append_n(sb, (char *) header, sizeof(header));
+
+  for (int i = 0; i < cache->capacity; i++) {
+    FuncCacheEntry *entry = &cache->entries[i];
+    if (entry->data == NULL) continue;
+    uint64_t fields[3] = {entry->key, (uint64_t) entry->nCommands, entry->len};
+    sb_append_n(sb, (char *) fields, sizeof(fields));
+    sb_append_n(sb, entry->data, (int) entry->len);
+  }
+
+  char *data = sb->data;
+  *len = sb->len;
+  free(sb);
+  return data;
+}
+
+// a missing or unreadable file gives an empty cache
+FuncCache *load_func_cache(char *path) {
+  FuncCache *cache = new_func_cache();
+
+  size_t len;
+  char *data = read_whole_file(path, &len);
+  if (data == NULL) return cache;
+
+  uint64_t header[3];
+  if (len < sizeof(header)) {
+    free(data);
+    return cache;
+  }
+  memcpy(header, data, sizeof(header));
+  if (memcmp(&header[0], "JFNC", 4) != 0 || header[1] != FUNC_CACHE_VERSION) {
+    free(data);
+    return cache;
+  }
+
+  size_t pos = sizeof(header);
+  for (uint64_t i = 0; i < header[2]; i++) {
+    uint64_t fields[3];
+    if (len - pos < sizeof(fields)) break;
+    memcpy(fields, data + pos, sizeof(fields));
+    pos += sizeof(fields);
+    if (len - pos < fields[2]) break;
+
+    func_cache_put(cache, fields[0], data + pos, fields[2], (long) fields[1]);
+    pos += fields[2];
+  }
+
+  free(data);
+  for (int i = 0; i < cache->capacity; i++) {
+    cache->entries[i].used = false;
+  }
+  return cache;
+}
+
+char *func_cache_path(char *cacheDir, char *className) {
+  StringBuilder *sb = new_sb();
+  sb_concat_strings(sb, 4, cacheDir, "/", className, ".vmc");
+  char *path = sb_get(sb);
+  free(sb);
+  return path;
+}
@@ -0,0 +1,36 @@
+
+#ifndef COMPILER_FUNC_CACHE_H
+#define COMPILER_FUNC_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "parser.h"
+
+typedef struct {
+  uint64_t key;
+  char *data;
+  size_t len;
+  long nCommands;
+  bool used;
+} FuncCacheEntry;
+
+// The generated code of single subroutines, keyed by a hash of the subroutine,
+// the class symbol table and the code generation settings. A class is
+// reassembled from the cached subroutines and only edited ones are generated.
+typedef struct {
+  FuncCacheEntry *entries;
+  int capacity;
+  int len;
+} FuncCache;
+
+FuncCache *new_func_cache(void);
+uint64_t function_key(Class *class, Function *func, uint64_t config);
+FuncCacheEntry *func_cache_get(FuncCache *cache, uint64_t key);
+void func_cache_put(FuncCache *cache, uint64_t key, char *data, size_t len, long nCommands);
+void func_cache_prune(FuncCache *cache);
+
+FuncCache *load_func_cache(char *path);
+char *serialize_func_cache(FuncCache *cache, size_t *len);
+char *func_cache_path(char *cacheDir, char *className);
+
+#endif //COMPILER_FUNC_CACHE_H
@@ -0,0 +1,298 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "inliner.h"
+#include "passes.h"
+#include "compilation_engine.h"
+
+static bool uses_segment(IrFunction *ir, Segment segment) {
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == segment) return true;
+  }
+  return false;
+}
+
+// pointer 0 for this, 1 for that; stores only if setOnly
+static bool uses_pointer(IrFunction *ir, int pointer, bool setOnly) {
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if (instr->op != IR_POP && (setOnly || instr->op != IR_PUSH)) continue;
+    if (instr->arg == SEGMENT_POINTER && instr->operand == pointer) return true;
+  }
+  return false;
+}
+
+static uint64_t hash_ir(IrFunction *ir) {
+  uint64_t hash = 0;
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    hash = hash * 31 + ((uint64_t) instr->op << 40 | (uint64_t) instr->arg << 20 | (uint16_t) instr->operand);
+    if (instr->name >= 0) {
+      IrName *name = &ir->names[instr->name];
+      hash ^= hash_bytes(name->name, strlen(name->name));
+      if (name->className != NULL) hash ^= hash_bytes(name->className, strlen(name->className)) * 31;
+    }
+  }
+  return hash;
+}
+
+static void describe(InlineCandidate *candidate, char *className, IrFunction *ir, int limit) {
+  candidate->className = className;
+  candidate->ir = ir;
+  candidate->nLocals = ir->code[0].operand;
+  candidate->size = ir->len - 1;
+  candidate->usesStatics = uses_segment(ir, SEGMENT_STATIC);
+  candidate->setsThis = uses_pointer(ir, 0, true);
+  candidate->setsThat = uses_pointer(ir, 1, true);
+
+  char *name = ir->names[ir->code[0].name].name;
+  candidate->recursive = false;
+  for (int i = 1; i < ir->len; i++) {
+    if (ir_is_call(ir, &ir->code[i], className, name)) candidate->recursive = true;
+  }
+
+  // the body has to end in its return to fall through to the caller
+  bool inlinable = candidate->size <= limit && ir->code[ir->len - 1].op == IR_RETURN && !candidate->recursive;
+  if (!inlinable) {
+    free_ir_function(ir);
+    candidate->ir = NULL;
+  }
+}
+
+// generates every reachable subroutine of the program without passes and
+// keeps the ones small enough to be inlined
+InlineTable *new_inline_table(CallGraph *graph, SignatureIndex *signatures, int limit) {
+  InlineTable *table = malloc(sizeof(InlineTable));
+  table->graph = graph;
+  table->candidates = calloc(graph->nFuncs, sizeof(InlineCandidate));
+  table->limit = limit;
+  table->hash = (uint64_t) limit;
+
+  for (int c = 0; c < graph->nClasses; c++) {
+    Class *class = graph->classes[c];
+    CompilationEngine *engine = new_engine(new_null_writer(), class);
+    engine->signatures = signatures;
+
+    for (int f = graph->first[c]; f < graph->first[c + 1]; f++) {
+      InlineCandidate *candidate = &table->candidates[f];
+      Function *func = graph->funcs[f];
+      candidate->className = class->name;
+      candidate->nArgs = varCount(func->lTable, KIND_ARG);
+      if (!graph->reachable[f]) continue;
+
+      describe(candidate, class->name, compile_subroutine_ir(engine, func), limit);
+      if (candidate->ir != NULL) {
+        table->hash = table->hash * 31 + hash_ir(candidate->ir);
+      }
+    }
+    free(engine->writer);
+    free(engine);
+  }
+  return table;
+}
+
+// NULL if Class.name is not part of the program
+InlineCandidate *find_inline_candidate(InlineTable *table, char *className, char *name) {
+  int f = find_subroutine(table->graph, className, name);
+  return f >= 0 ? &table->candidates[f] : NULL;
+}
+
+/*============================ Pass ============================ */
+
+typedef struct {
+  PassContext *ctx;
+  IrFunction *ir;
+  // the locals of an inlined body start after those of the caller
+  int base;
+  // whether the caller relies on pointer 0 and 1, which a call would restore
+  bool usesThis;
+  bool usesThat;
+  int sites;
+} Inliner;
+
+typedef struct {
+  IrInstr *code;
+  int len;
+} Sequence;
+
+static void emit(Sequence *seq, IrInstr instr) {
+  seq->code[seq->len++] = instr;
+}
+
+static int renamed_label(Inliner *inliner, InlineCandidate *candidate, char *label) {
+  StringBuilder *sb = new_sb();
+  sb_concat_strings(sb, 4, candidate->className, ".", label, "$");
+  sb_append_i(sb, inliner->sites);
+  char *name = sb_get(sb);
+  int id = ir_intern(inliner->ir, NULL, name);
+  free(name);
+  return id;
+}
+
+// a local the callee reads before its first store starts out as 0, as it
+// would in a frame of its own
+static bool needs_zero(IrFunction *body, int local) {
+  for (int i = 1; i < body->len; i++) {
+    IrInstr *instr = &body->code[i];
+    if (instr->op == IR_LABEL || instr->op == IR_GOTO || instr->op == IR_IF_GOTO) return true;
+    if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == SEGMENT_LOCAL && instr->operand == local) {
+      return instr->op == IR_PUSH;
+    }
+  }
+  return false;
+}
+
+// the object of a method is on top of the stack when the body starts by
+// pushing it, so it need not go through a local if that is its only use
+static bool passes_first_argument(IrFunction *body) {
+  if (body->len < 2) return false;
+  IrInstr *first = &body->code[1];
+  if (first->op != IR_PUSH || first->arg != SEGMENT_ARG || first->operand != 0) return false;
+
+  for (int i = 2; i < body->len; i++) {
+    IrInstr *instr = &body->code[i];
+    if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == SEGMENT_ARG && instr->operand == 0) return false;
+  }
+  return true;
+}
+
+static IrInstr remap(Inliner *inliner, InlineCandidate *candidate, IrInstr instr) {
+  IrFunction *body = candidate->ir;
+  if (instr.op == IR_PUSH || instr.op == IR_POP) {
+    if (instr.arg == SEGMENT_ARG) {
+      instr.arg = SEGMENT_LOCAL;
+      instr.operand += inliner->base;
+    } else if (instr.arg == SEGMENT_LOCAL) {
+      instr.operand += inliner->base + candidate->nArgs;
+    }
+  } else if (instr.op == IR_LABEL || instr.op == IR_GOTO || instr.op == IR_IF_GOTO) {
+    instr.name = renamed_label(inliner, candidate, body->names[instr.name].name);
+  } else if (instr.op == IR_CALL) {
+    IrName *callee = &body->names[instr.name];
+    instr.name = ir_intern(inliner->ir, callee->className, callee->name);
+  }
+  return instr;
+}
+
+// the commands that replace a call: the arguments move from the stack into
+// fresh locals, every return but the last jumps to the end, and the pointers
+// the body sets are put back as the return of a call would
+static int expand(Inliner *inliner, InlineCandidate *candidate, Sequence *seq) {
+  IrFunction *body = candidate->ir;
+  int nArgs = candidate->nArgs;
+  int saved = inliner->base + nArgs + candidate->nLocals;
+  bool saveThis = inliner->usesThis && candidate->setsThis;
+  bool saveThat = inliner->usesThat && candidate->setsThat;
+
+  if (saveThis) {
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_POINTER, 0, -1));
+    emit(seq, ir_instr(IR_POP, SEGMENT_LOCAL, saved, -1));
+  }
+  if (saveThat) {
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_POINTER, 1, -1));
+    emit(seq, ir_instr(IR_POP, SEGMENT_LOCAL, saved + saveThis, -1));
+  }
+
+  bool direct = nArgs > 0 && passes_first_argument(body);
+  for (int i = nArgs - 1; i >= direct; i--) {
+    emit(seq, ir_instr(IR_POP, SEGMENT_LOCAL, inliner->base + i, -1));
+  }
+  for (int i = 0; i < candidate->nLocals; i++) {
+    if (!needs_zero(body, i)) continue;
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_CONST, 0, -1));
+    emit(seq, ir_instr(IR_POP, SEGMENT_LOCAL, inliner->base + nArgs + i, -1));
+  }
+
+  int end = -1;
+  for (int i = direct ? 2 : 1; i < body->len; i++) {
+    if (body->code[i].op != IR_RETURN) {
+      emit(seq, remap(inliner, candidate, body->code[i]));
+    } else if (i < body->len - 1) {
+      if (end < 0) end = renamed_label(inliner, candidate, "RETURN");
+      emit(seq, ir_instr(IR_GOTO, 0, 0, end));
+    }
+  }
+  if (end >= 0) {
+    emit(seq, ir_instr(IR_LABEL, 0, 0, end));
+  }
+
+  // the returned value stays on top of the stack
+  if (saveThis) {
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_LOCAL, saved, -1));
+    emit(seq, ir_instr(IR_POP, SEGMENT_POINTER, 0, -1));
+  }
+  if (saveThat) {
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_LOCAL, saved + saveThis, -1));
+    emit(seq, ir_instr(IR_POP, SEGMENT_POINTER, 1, -1));
+  }
+  return nArgs + candidate->nLocals + saveThis + saveThat;
+}
+
+static bool inlinable(Inliner *inliner, InlineCandidate *candidate, IrInstr *call, int line) {
+  PassContext *ctx = inliner->ctx;
+  char *name = inliner->ir->names[call->name].name;
+
+  if (candidate->recursive) {
+    pass_remark(ctx, REMARK_MISSED, line, 0, "%s.%s not inlined since it calls itself", candidate->className, name);
+    return false;
+  }
+  if (candidate->usesStatics && strcmp(candidate->className, ctx->class->name) != 0) {
+    pass_remark(ctx, REMARK_MISSED, line, 0, "%s.%s not inlined since it uses the statics of its class",
+                candidate->className, name);
+    return false;
+  }
+  if (candidate->ir == NULL) {
+    pass_remark(ctx, REMARK_MISSED, line, 0, "%s.%s not inlined, %i commands are over the limit of %i",
+                candidate->className, name, candidate->size, ctx->inlines->limit);
+    return false;
+  }
+  return call->operand == candidate->nArgs;
+}
+
+int inline_calls(PassContext *ctx) {
+  InlineTable *table = ctx->inlines;
+  if (table == NULL) return 0;
+
+  IrFunction *ir = ctx->ir;
+  Inliner inliner = {ctx, ir, ir->code[0].operand, false, false, 0};
+  inliner.usesThis = uses_segment(ir, SEGMENT_THIS) || uses_pointer(ir, 0, false);
+  inliner.usesThat = uses_segment(ir, SEGMENT_THAT) || uses_pointer(ir, 1, false);
+
+  // sites never overlap, so they share the locals they add
+  int extraLocals = 0;
+  int changes = 0;
+  for (int i = 1; i < ir->len; i++) {
+    IrInstr call = ir->code[i];
+    if (call.op != IR_CALL) continue;
+    IrName *callee = &ir->names[call.name];
+    InlineCandidate *candidate = find_inline_candidate(table, callee->className, callee->name);
+    if (candidate == NULL || !inlinable(&inliner, candidate, &call, ir->lines[i])) continue;
+
+    char *className = candidate->className;
+    char *name = strdup(callee->name);
+    IrFunction *body = candidate->ir;
+    Sequence seq = {malloc(sizeof(IrInstr) * (body->len + candidate->nArgs + 2 * candidate->nLocals + 9)), 0};
+    int locals = expand(&inliner, candidate, &seq);
+
+    // at -Os the call has to be at least as short as it was
+    int limit = ctx->pm->level == OPT_OS ? 1 : table->limit;
+    if (seq.len > limit) {
+      pass_remark(ctx, REMARK_MISSED, ir->lines[i], 0, "%s.%s not inlined, %i commands are over the limit of %i",
+                  className, name, seq.len, limit);
+    } else {
+      pass_remark(ctx, REMARK_PASSED, ir->lines[i], 1 - seq.len, "inlined %s.%s as %i commands",
+                  className, name, seq.len);
+      ir_replace(ir, i, 1, seq.code, seq.len);
+      i += seq.len - 1;
+      if (locals > extraLocals) extraLocals = locals;
+      inliner.sites++;
+      changes++;
+    }
+    free(seq.code);
+    free(name);
+  }
+
+  ir->code[0].operand += extraLocals;
+  return changes;
+}
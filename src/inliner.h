@@ -0,0 +1,44 @@
+
+#ifndef COMPILER_INLINER_H
+#define COMPILER_INLINER_H
+
+#include <stdint.h>
+#include "util.h"
+#include "vm_ir.h"
+#include "pass_manager.h"
+#include "call_graph.h"
+#include "signature_index.h"
+
+// A subroutine of the program as seen from a call to it: the IR it compiles
+// to before any pass, and the facts that decide whether the call may be
+// replaced with it.
+typedef struct {
+  char *className;
+  // NULL if the subroutine is unreachable or too large to be inlined
+  IrFunction *ir;
+  // including the object of a method
+  int nArgs;
+  int nLocals;
+  // commands after the function command
+  int size;
+  // statics belong to the file of the class, so the body only fits there
+  bool usesStatics;
+  bool recursive;
+  bool setsThis;
+  bool setsThat;
+} InlineCandidate;
+
+// the subroutines of a whole program, indexed like graph->funcs
+struct InlineTable {
+  CallGraph *graph;
+  InlineCandidate *candidates;
+  // most commands a call may turn into
+  int limit;
+  // changes with every inlinable body and with the limit
+  uint64_t hash;
+};
+
+InlineTable *new_inline_table(CallGraph *graph, SignatureIndex *signatures, int limit);
+InlineCandidate *find_inline_candidate(InlineTable *table, char *className, char *name);
+
+#endif //COMPILER_INLINER_H
@@ -0,0 +1,477 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "io_batch.h"
+
+#define QUEUE_DEPTH 64
+#define POOL_THREADS 4
+#define READ_CHUNK 16384
+
+typedef enum {
+  STAGE_OPEN,
+  STAGE_TRANSFER,
+  STAGE_CLOSE,
+  STAGE_DONE
+} Stage;
+
+typedef struct {
+  char *path;
+  bool isWrite;
+  Stage stage;
+  bool failed;
+  int fd;
+  char *data;
+  size_t len;       // bytes read so far, or bytes written so far
+  size_t capacity;  // read buffer size, or total bytes to write
+} IORequest;
+
+typedef struct {
+  int fd;
+  unsigned *sqHead;
+  unsigned *sqTail;
+  unsigned sqMask;
+  unsigned sqEntries;
+  unsigned *sqArray;
+  struct io_uring_sqe *sqes;
+  unsigned *cqHead;
+  unsigned *cqTail;
+  unsigned cqMask;
+  struct io_uring_cqe *cqes;
+  unsigned toSubmit;
+  unsigned inFlight;
+} Uring;
+
+struct IOBatch {
+  Vector *requests;
+  int nextToStart;
+  bool useUring;
+  Uring ring;
+
+  pthread_t threads[POOL_THREADS];
+  pthread_mutex_t lock;
+  pthread_cond_t jobReady;
+  pthread_cond_t jobDone;
+  bool poolStarted;
+};
+
+/*============================ Blocking requests ============================ */
+
+// used by the thread pool and whenever io_uring rejects an operation;
+// the caller marks the request as done
+static void run_blocking(IORequest *req) {
+  int fd = req->isWrite ? open(req->path, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open(req->path, O_RDONLY);
+  if (fd < 0) {
+    req->failed = true;
+    return;
+  }
+
+  if (req->isWrite) {
+    while (req->len < req->capacity) {
+      ssize_t n = write(fd, req->data + req->len, req->capacity - req->len);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) {
+        req->failed = true;
+        break;
+      }
+      req->len += n;
+    }
+  } else {
+    while (true) {
+      if (req->len == req->capacity) {
+        req->capacity *= 2;
+        req->data = realloc(req->data, req->capacity + 1);
+      }
+      ssize_t n = read(fd, req->data + req->len, req->capacity - req->len);
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0) req->failed = true;
+      if (n <= 0) break;
+      req->len += n;
+    }
+  }
+
+  close(fd);
+}
+
+/*============================ io_uring backend ============================ */
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+  return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+  return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static bool init_uring(Uring *ring) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = uring_setup(QUEUE_DEPTH, &params);
+  if (fd < 0) return false;
+
+  size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (singleMmap && cqSize > sqSize) sqSize = cqSize;
+
+  char *sq = mmap(NULL, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  char *cq = sq;
+  if (!singleMmap) {
+    cq = mmap(NULL, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+  }
+
+  struct io_uring_sqe *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+                                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  ring->fd = fd;
+  ring->sqHead = (unsigned *) (sq + params.sq_off.head);
+  ring->sqTail = (unsigned *) (sq + params.sq_off.tail);
+  ring->sqMask = *(unsigned *) (sq + params.sq_off.ring_mask);
+  ring->sqEntries = params.sq_entries;
+  ring->sqArray = (unsigned *) (sq + params.sq_off.array);
+  ring->sqes = sqes;
+  ring->cqHead = (unsigned *) (cq + params.cq_off.head);
+  ring->cqTail = (unsigned *) (cq + params.cq_off.tail);
+  ring->cqMask = *(unsigned *) (cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+  ring->toSubmit = 0;
+  ring->inFlight = 0;
+  return true;
+}
+
+static void uring_submit(Uring *ring, unsigned minComplete) {
+  unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  while (ring->toSubmit > 0 || minComplete > 0) {
+    int submitted = uring_enter(ring->fd, ring->toSubmit, minComplete, flags);
+    if (submitted < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      xprintf("io_uring_enter failed: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+    }
+    ring->toSubmit -= submitted;
+    minComplete = 0;
+    flags = 0;
+  }
+}
+
+static void queue_stage(IOBatch *batch, int id) {
+  Uring *ring = &batch->ring;
+  IORequest *req = vec_get(batch->requests, id);
+
+  unsigned tail = *ring->sqTail;
+  unsigned index = tail & ring->sqMask;
+  struct io_uring_sqe *sqe = &ring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+
+  switch (req->stage) {
+    case STAGE_OPEN:
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (unsigned long) req->path;
+      sqe->open_flags = req->isWrite ? O_WRONLY | O_CREAT | O_TRUNC : O_RDONLY;
+      sqe->len = 0644;
+      break;
+    case STAGE_TRANSFER:
+      sqe->opcode = req->isWrite ? IORING_OP_WRITE : IORING_OP_READ;
+      sqe->fd = req->fd;
+      sqe->addr = (unsigned long) (req->data + req->len);
+      sqe->len = req->capacity - req->len;
+      sqe->off = req->len;
+      break;
+    case STAGE_CLOSE:
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = req->fd;
+      break;
+    default:
+      return;
+  }
+  sqe->user_data = id;
+
+  ring->sqArray[index] = index;
+  __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+  ring->toSubmit++;
+  ring->inFlight++;
+}
+
+static void complete_stage(IOBatch *batch, int id, int res) {
+  IORequest *req = vec_get(batch->requests, id);
+
+  switch (req->stage) {
+    case STAGE_OPEN:
+      if (res == -EINVAL || res == -EOPNOTSUPP) {
+        // the kernel does not know the opcode; do the whole request by hand
+        run_blocking(req);
+        req->stage = STAGE_DONE;
+        return;
+      }
+      if (res < 0) {
+        req->failed = true;
+        req->stage = STAGE_DONE;
+        return;
+      }
+      req->fd = res;
+      req->stage = STAGE_TRANSFER;
+      break;
+    case STAGE_TRANSFER:
+      if (res < 0) {
+        req->failed = true;
+        req->stage = STAGE_CLOSE;
+        break;
+      }
+      if (req->isWrite) {
+        req->len += res;
+        if (req->len == req->capacity || res == 0) {
+          req->failed = req->len != req->capacity;
+          req->stage = STAGE_CLOSE;
+        }
+        break;
+      }
+      if (res == 0) {
+        req->stage = STAGE_CLOSE;
+        break;
+      }
+      req->len += res;
+      if (req->len == req->capacity) {
+        req->capacity *= 2;
+        req->data = realloc(req->data, req->capacity + 1);
+      }
+      break;
+    case STAGE_CLOSE:
+      req->stage = STAGE_DONE;
+      return;
+    default:
+      return;
+  }
+
+  queue_stage(batch, id);
+}
+
+static void start_pending(IOBatch *batch) {
+  Uring *ring = &batch->ring;
+  while (batch->nextToStart < batch->requests->len && ring->inFlight < ring->sqEntries) {
+    queue_stage(batch, batch->nextToStart++);
+  }
+}
+
+// submits what is queued and reaps at least one completion
+static void uring_poll(IOBatch *batch) {
+  Uring *ring = &batch->ring;
+  start_pending(batch);
+  uring_submit(ring, ring->inFlight > 0 ? 1 : 0);
+
+  unsigned head = *ring->cqHead;
+  while (head != __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE)) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+    int id = (int) cqe->user_data;
+    int res = cqe->res;
+    head++;
+    __atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+    ring->inFlight--;
+    complete_stage(batch, id, res);
+  }
+}
+
+/*============================ Thread pool backend ============================ */
+
+static void *pool_worker(void *arg) {
+  IOBatch *batch = arg;
+
+  while (true) {
+    pthread_mutex_lock(&batch->lock);
+    while (batch->nextToStart >= batch->requests->len) {
+      pthread_cond_wait(&batch->jobReady, &batch->lock);
+    }
+    IORequest *req = vec_get(batch->requests, batch->nextToStart++);
+    pthread_mutex_unlock(&batch->lock);
+
+    run_blocking(req);
+
+    pthread_mutex_lock(&batch->lock);
+    req->stage = STAGE_DONE;
+    pthread_cond_broadcast(&batch->jobDone);
+    pthread_mutex_unlock(&batch->lock);
+  }
+  return NULL;
+}
+
+static void start_pool(IOBatch *batch) {
+  pthread_mutex_init(&batch->lock, NULL);
+  pthread_cond_init(&batch->jobReady, NULL);
+  pthread_cond_init(&batch->jobDone, NULL);
+
+  for (int i = 0; i < POOL_THREADS; i++) {
+    pthread_create(&batch->threads[i], NULL, pool_worker, batch);
+    pthread_detach(batch->threads[i]);
+  }
+  batch->poolStarted = true;
+}
+
+/*============================ Public interface ============================ */
+
+IOBatch *new_io_batch(void) {
+  IOBatch *batch = malloc(sizeof(IOBatch));
+  batch->requests = new_vec();
+  batch->nextToStart = 0;
+  batch->poolStarted = false;
+  batch->useUring = init_uring(&batch->ring);
+
+  if (!batch->useUring) {
+    start_pool(batch);
+  }
+  return batch;
+}
+
+bool io_batch_uses_uring(IOBatch *batch) {
+  return batch->useUring;
+}
+
+static int add_request(IOBatch *batch, IORequest *req) {
+  if (batch->useUring) {
+    vec_push(batch->requests, req);
+    return batch->requests->len - 1;
+  }
+
+  pthread_mutex_lock(&batch->lock);
+  vec_push(batch->requests, req);
+  int id = batch->requests->len - 1;
+  pthread_cond_signal(&batch->jobReady);
+  pthread_mutex_unlock(&batch->lock);
+  return id;
+}
+
+static IORequest *new_request(char *path, bool isWrite) {
+  IORequest *req = malloc(sizeof(IORequest));
+  req->path = path;
+  req->isWrite = isWrite;
+  req->stage = STAGE_OPEN;
+  req->failed = false;
+  req->fd = -1;
+  req->data = NULL;
+  req->len = 0;
+  req->capacity = 0;
+  return req;
+}
+
+int io_batch_read(IOBatch *batch, char *path) {
+  IORequest *req = new_request(path, false);
+  req->capacity = READ_CHUNK;
+  req->data = malloc(req->capacity + 1);
+  return add_request(batch, req);
+}
+
+void io_batch_write(IOBatch *batch, char *path, char *data, size_t len) {
+  IORequest *req = new_request(path, true);
+  req->data = data;
+  req->capacity = len;
+  add_request(batch, req);
+}
+
+static bool is_done(IOBatch *batch, IORequest *req) {
+  if (batch->useUring) return req->stage == STAGE_DONE;
+
+  pthread_mutex_lock(&batch->lock);
+  while (req->stage != STAGE_DONE) {
+    pthread_cond_wait(&batch->jobDone, &batch->lock);
+  }
+  pthread_mutex_unlock(&batch->lock);
+  return true;
+}
+
+// returns a null terminated buffer with the file contents, NULL if the file could not be read
+char *io_batch_wait_read(IOBatch *batch, int id, size_t *len) {
+  IORequest *req = vec_get(batch->requests, id);
+  while (!is_done(batch, req)) {
+    uring_poll(batch);
+  }
+
+  if (req->failed) return NULL;
+  req->data[req->len] = '\0';
+  *len = req->len;
+  return req->data;
+}
+
+// waits for every outstanding request; returns false if any of the writes failed
+bool io_batch_finish(IOBatch *batch) {
+  bool ok = true;
+  for (int i = 0; i < batch->requests->len; i++) {
+    IORequest *req = vec_get(batch->requests, i);
+    while (!is_done(batch, req)) {
+      uring_poll(batch);
+    }
+    if (req->isWrite && req->failed) {
+      xprintf("could not write %s\n", req->path);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+// a single synchronous read for callers that only need one file
+char *read_whole_file(char *path, size_t *len) {
+  IORequest *req = new_request(path, false);
+  req->capacity = READ_CHUNK;
+  req->data = malloc(req->capacity + 1);
+  run_blocking(req);
+
+  char *data = req->data;
+  bool failed = req->failed;
+  *len = req->len;
+  free(req);
+
+  if (failed) {
+    free(data);
+    return NULL;
+  }
+  data[*len] = '\0';
+  return data;
+}
+
+// d_type spares the stat call for every entry on file systems that fill it in
+Vector *list_jack_files(char *dirPath) {
+  Vector *paths = new_vec();
+  DIR *dir = opendir(dirPath);
+  if (dir == NULL) return paths;
+
+  struct dirent *dp;
+  while ((dp = readdir(dir)) != NULL) {
+    if (dp->d_type != DT_REG && dp->d_type != DT_UNKNOWN && dp->d_type != DT_LNK) continue;
+
+    StringBuilder *sb = new_sb();
+    sb_concat_strings(sb, 3, dirPath, "/", dp->d_name);
+    char *entry = sb_get(sb);
+
+    if (!has_jack_extension(entry) || (dp->d_type != DT_REG && !is_reg_file(entry))) {
+      free(entry);
+      free(sb);
+      continue;
+    }
+
+    vec_push(paths, entry);
+    free(sb);
+  }
+
+  closedir(dir);
+  return paths;
+}
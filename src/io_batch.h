@@ -0,0 +1,25 @@
+
+#ifndef COMPILER_IO_BATCH_H
+#define COMPILER_IO_BATCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "util.h"
+
+// Batched file I/O for directory builds. All reads are submitted up front and
+// complete in the background while earlier files are being compiled; writes are
+// queued as soon as a class has been generated. io_uring is used when the kernel
+// allows it, otherwise the requests are served by a small pool of threads.
+typedef struct IOBatch IOBatch;
+
+IOBatch *new_io_batch(void);
+int io_batch_read(IOBatch *batch, char *path);
+char *io_batch_wait_read(IOBatch *batch, int id, size_t *len);
+void io_batch_write(IOBatch *batch, char *path, char *data, size_t len);
+bool io_batch_finish(IOBatch *batch);
+bool io_batch_uses_uring(IOBatch *batch);
+
+char *read_whole_file(char *path, size_t *len);
+Vector *list_jack_files(char *dirPath);
+
+#endif //COMPILER_IO_BATCH_H
@@ -13,13 +13,7 @@ static Map *keywords_table;
 static Map *new_keyword_map();
 static void add_next_token(Tokenizer *tokenizer);
 
-Tokenizer *new_tokenizer(char *path) {
-  FILE *inStream = fopen(path, "r");
-
-  if (inStream == NULL) {
-    exit(EXIT_FAILURE);
-  }
-
+static Tokenizer *init_tokenizer(FILE *inStream) {
   Tokenizer *tokenizer = malloc(sizeof(Tokenizer));
   tokenizer->inStream = inStream;
   tokenizer->hasMoreTokens = true;
@@ -32,6 +26,27 @@ Tokenizer *new_tokenizer(char *path) {
   return tokenizer;
 }
 
+Tokenizer *new_tokenizer(char *path) {
+  FILE *inStream = fopen(path, "r");
+
+  if (inStream == NULL) {
+    abort_compilation();
+  }
+
+  return init_tokenizer(inStream);
+}
+
+// the source has already been read into memory (see io_batch.c)
+Tokenizer *new_tokenizer_from_buffer(char *data, size_t len) {
+  FILE *inStream = fmemopen(data, len > 0 ? len : 1, "r");
+
+  if (inStream == NULL) {
+    abort_compilation();
+  }
+
+  return init_tokenizer(inStream);
+}
+
 // ------------------------------- New methods --------------------------
 Token *peek(Tokenizer *tokenizer) {
   return vec_get(tokenizer->tokens, tokenizer->end);
@@ -61,6 +76,11 @@ char *get_string(Tokenizer *tokenizer) {
   return ((Token *) vec_get(tokenizer->tokens, tokenizer->current))->stringValue;
 }
 
+// the line of the current token; lineNumber may already be past it
+int get_line(Tokenizer *tokenizer) {
+  return ((Token *) vec_get(tokenizer->tokens, tokenizer->current))->line;
+}
+
 Token *lookahead(Tokenizer *tokenizer) {
   add_next_token(tokenizer);
   tokenizer->current--;
@@ -76,13 +96,17 @@ void close_tokenizer(Tokenizer *tokenizer) {
   free(tokenizer);
 }
 
+// the parser queries the keyword/symbol/identifier of any token, so the
+// fields that do not apply must hold values that never match
 static Token *new_token(TokenType tokenType) {
-  Token *token = malloc(sizeof(Token));
+  Token *token = calloc(1, sizeof(Token));
   token->tokenType = tokenType;
+  token->keyword = (KeyWord) -1;
   return token;
 }
 
 static void add_token(Tokenizer *tokenizer, Token *token) {
+  token->line = tokenizer->lineNumber;
   vec_push(tokenizer->tokens, token);
   tokenizer->current++;
   tokenizer->end++;
@@ -101,6 +125,11 @@ TokenType advance(Tokenizer *tokenizer) {
   return get_token_type(tokenizer);
 }
 
+static void unexpected_eof(Tokenizer *tokenizer) {
+  xprintf("Unexpected end of file at line %i\n", tokenizer->lineNumber);
+  abort_compilation();
+}
+
 static void add_next_token(Tokenizer *tokenizer) {
   if (!tokenizer->hasMoreTokens) {
     return;
@@ -126,7 +155,8 @@ static void add_next_token(Tokenizer *tokenizer) {
       int chrSecond = getc(tokenizer->inStream);
 
       if (chrSecond == '/') {
-        while (getc(tokenizer->inStream) != '\n');
+        int tmp;
+        while ((tmp = getc(tokenizer->inStream)) != '\n' && tmp != EOF);
         tokenizer->lineNumber++;
         continue;
       } else if (chrSecond == '*') {
@@ -135,6 +165,7 @@ static void add_next_token(Tokenizer *tokenizer) {
 
         while (true) {
           int tmp2 = getc(tokenizer->inStream);
+          if (tmp2 == EOF) unexpected_eof(tokenizer);
           if (tmp2 == '\n') tokenizer->lineNumber++;
           if (tmp1 == '*' && tmp2 == '/') break;
           tmp1 = tmp2;
@@ -151,6 +182,7 @@ static void add_next_token(Tokenizer *tokenizer) {
 
       int tmp;
       while ((tmp = getc(tokenizer->inStream)) != '"') {
+        if (tmp == EOF) unexpected_eof(tokenizer);
         sb_add(tmpSb, tmp);
       };
 
@@ -294,7 +326,7 @@ char *keyword_to_string(KeyWord keyWord) {
       return "false";
     default:
       xprintf("%i is not specified in keyword_to_string", keyWord);
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -310,7 +342,7 @@ KeywordConst keyword_to_keywordConst(KeyWord keyWord) {
       return KC_FALSE;
     default:
       xprintf("%s is not specified in keyword_to_keywordConst", keyword_to_string(keyWord));
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -393,7 +425,7 @@ bool is_term(Tokenizer *tokenizer) {
 void raise_error(Tokenizer *tokenizer) {
   xprintf("Wrong token at line %i\n", tokenizer->lineNumber);
   xprintf("TokenType %i", get_token_type(tokenizer));
-  exit(EXIT_FAILURE);
+  abort_compilation();
 }
 
 char *expect_identifier(Tokenizer *tokenizer) {
@@ -62,11 +62,14 @@ typedef struct {
   char *identifier;
   char symbol;
   char *stringValue;
+  int line;
 } Token;
 
 
 Tokenizer *new_tokenizer(char *path);
+Tokenizer *new_tokenizer_from_buffer(char *data, size_t len);
 TokenType advance(Tokenizer *tokenizer);
+int get_line(Tokenizer *tokenizer);
 Token *lookahead(Tokenizer *tokenizer);
 
 TokenType get_token_type(Tokenizer *tokenizer);
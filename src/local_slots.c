@@ -0,0 +1,138 @@
+
+#include <stdlib.h>
+#include "passes.h"
+#include "dataflow.h"
+
+// Locals are given slots the way registers are allocated: two locals that
+// are never live at the same time may share a slot, and a local the code
+// never refers to needs none. Every slot of the frame costs a push of 0 on
+// each call, so the function command asks for only as many as are used.
+// A local read before it is stored holds the 0 its slot starts with; it is
+// live from the start, so no other local is stored to its slot before.
+
+typedef struct {
+  int nLocals;
+  bool *used;
+  // nLocals x nLocals
+  bool *conflicts;
+  // locals copied to each other, given the same slot where possible
+  int *copies;
+  int nCopies;
+} Slots;
+
+static void add_conflict(Slots *slots, int a, int b) {
+  slots->conflicts[a * slots->nLocals + b] = true;
+  slots->conflicts[b * slots->nLocals + a] = true;
+}
+
+// a local conflicts with every other local live where it is stored
+static void find_conflicts(Dataflow *df, Slots *slots) {
+  IrFunction *ir = df->ir;
+  int n = slots->nLocals;
+  bool *live = malloc(sizeof(bool) * n);
+
+  for (int o = 0; o < df->nOrder; o++) {
+    Block *block = &df->blocks[df->order[o]];
+    uint64_t *out = &df->liveOut[df->order[o] * df->varWords];
+    for (int v = 0; v < n; v++) {
+      live[v] = (out[v / 64] >> (v % 64)) & 1;
+    }
+
+    for (int i = block->end - 1; i >= block->start; i--) {
+      IrInstr *instr = &ir->code[i];
+      int var = dataflow_variable(df, instr);
+      if (var == -1 || var >= n) continue;
+
+      if (instr->op == IR_PUSH) {
+        live[var] = true;
+        continue;
+      }
+      for (int other = 0; other < n; other++) {
+        if (other != var && live[other]) add_conflict(slots, var, other);
+      }
+      live[var] = false;
+      IrInstr *source = &ir->code[i - 1];
+      if (source->op == IR_PUSH && source->arg == SEGMENT_LOCAL && source->operand != var) {
+        slots->copies[2 * slots->nCopies] = var;
+        slots->copies[2 * slots->nCopies + 1] = source->operand;
+        slots->nCopies++;
+      }
+    }
+  }
+  free(live);
+}
+
+static bool fits(Slots *slots, int *slot, int var, int candidate) {
+  for (int other = 0; other < slots->nLocals; other++) {
+    if (slot[other] == candidate && slots->conflicts[var * slots->nLocals + other]) return false;
+  }
+  return true;
+}
+
+// greedy coloring in the order the locals are declared, trying the slots of
+// the locals a local is copied from or to first
+static int assign_slots(Slots *slots, int *slot) {
+  int nSlots = 0;
+  for (int var = 0; var < slots->nLocals; var++) {
+    slot[var] = -1;
+  }
+
+  for (int var = 0; var < slots->nLocals; var++) {
+    if (!slots->used[var]) continue;
+
+    int chosen = -1;
+    for (int c = 0; c < slots->nCopies && chosen == -1; c++) {
+      int *pair = &slots->copies[2 * c];
+      int partner = pair[0] == var ? pair[1] : pair[1] == var ? pair[0] : -1;
+      if (partner != -1 && slot[partner] != -1 && fits(slots, slot, var, slot[partner])) chosen = slot[partner];
+    }
+    for (int candidate = 0; chosen == -1; candidate++) {
+      if (fits(slots, slot, var, candidate)) chosen = candidate;
+    }
+
+    slot[var] = chosen;
+    if (chosen >= nSlots) nSlots = chosen + 1;
+  }
+  return nSlots;
+}
+
+int allocate_locals(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  Dataflow *df = new_dataflow(ir);
+  int n = df->nLocals;
+  if (n == 0) {
+    free_dataflow(df);
+    return 0;
+  }
+
+  Slots slots = {n, calloc(n, sizeof(bool)), calloc((size_t) n * n, sizeof(bool)), malloc(sizeof(int) * 2 * ir->len), 0};
+  for (int i = 1; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == SEGMENT_LOCAL) slots.used[instr->operand] = true;
+  }
+  find_conflicts(df, &slots);
+
+  int *slot = malloc(sizeof(int) * n);
+  int nSlots = assign_slots(&slots, slot);
+  int moved = 0;
+  for (int i = 1; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if ((instr->op != IR_PUSH && instr->op != IR_POP) || instr->arg != SEGMENT_LOCAL) continue;
+    if (instr->operand != slot[instr->operand]) moved++;
+    instr->operand = slot[instr->operand];
+  }
+
+  int saved = ir->code[0].operand - nSlots;
+  if (saved > 0) {
+    pass_remark(ctx, REMARK_PASSED, ir->lines[0], saved, "the frame holds %i local%s instead of %i",
+                nSlots, nSlots == 1 ? "" : "s", ir->code[0].operand);
+    ir->code[0].operand = nSlots;
+  }
+
+  free(slot);
+  free(slots.used);
+  free(slots.conflicts);
+  free(slots.copies);
+  free_dataflow(df);
+  return (saved > 0 ? saved : 0) + moved;
+}
@@ -1,30 +1,19 @@
 #include <stdio.h>
-#include <libgen.h>
 #include <stdlib.h>
-#include <dirent.h>
-#include <sys/stat.h>
 #include "util.h"
 #include "lexer.h"
 #include "compilation_engine.h"
 #include "symbol_table.h"
 #include "parser.h"
-
-static char *get_basename_without_ext(char *path) {
-  char *baseName = basename(path);
-  char *nameWithoutExtension = sb_get((StringBuilder *) vec_get(split_by(baseName, '.'), 0));
-  return nameWithoutExtension;
-}
-
-static void process_file(char *path) {
-  Tokenizer *tokenizer = new_tokenizer(path);
-  Class *class = build_ast(tokenizer);
-
-  CompilationEngine *engine = new_engine(get_basename_without_ext(path), class);
-  compile_file(engine);
-}
+#include "io_batch.h"
+#include "build.h"
+#include "options.h"
+#include "watch.h"
+#include "vm_binary.h"
 
 int main(int argc, char *argv[]) {
-  if (argc != 2) {
+  Options *options = parse_options(argc, argv);
+  if (options == NULL) {
     xprintf("A wrong number of arguments is given to the program\n");
     exit(EXIT_FAILURE);
   }
@@ -33,47 +22,39 @@ int main(int argc, char *argv[]) {
     xprintf("i: %i; argv %s\n", i, *(argv + i));
   }
 
-  char *receivedPath = argv[1];
-
-  if (isDir(receivedPath)) {
-    struct dirent *dp;
-    struct stat statbuf;
-
-    bool isFirstFile = true;
-
-    DIR *dir = opendir(receivedPath);
-
-    while ((dp = readdir(dir)) != NULL) {
-      StringBuilder *sb = new_sb();
+  char *receivedPath = options->path;
 
-      sb_concat_strings(sb, 3, receivedPath, "/", dp->d_name);
-      char *entry = sb_get(sb);
-
-      if (stat(entry, &statbuf) == -1)
-        continue;
-
-      if (is_reg_file(entry) && has_jack_extension(entry)) {
-        if (isFirstFile) {
-          isFirstFile = false;
-        }
-        process_file(entry);
-      }
+  if (options->convertTo != NULL) {
+    return convert_vm_file(receivedPath, options->convertTo) ? 0 : EXIT_FAILURE;
+  }
 
-      free(sb);
+  if (options->watch) {
+    if (!isDir(receivedPath)) {
+      exit(EXIT_FAILURE);
     }
+    watch_directory(receivedPath, options);
+    return 0;
+  }
+
+  if (isDir(receivedPath)) {
+    Vector *paths = list_jack_files(receivedPath);
 
-    if (isFirstFile) {
+    if (paths->len == 0) {
       exit(EXIT_FAILURE);
     }
 
+    build_files(paths, options);
+    print_pass_report(options->passes);
     return 0;
   }
 
   if (is_reg_file(receivedPath) && has_jack_extension(receivedPath)) {
-    process_file(receivedPath);
+    Vector *paths = new_vec();
+    vec_push(paths, receivedPath);
+    build_files(paths, options);
+    print_pass_report(options->passes);
     return 0;
   }
 
   exit(EXIT_FAILURE);
 }
-
@@ -0,0 +1,178 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "options.h"
+#include "string_pool.h"
+#include "util.h"
+
+// -Rpass, -Rpass-missed and -Rpass-analysis, optionally followed by =<regex>
+static bool parse_remark_option(Options *options, char *arg) {
+  static char *NAMES[] = {"-Rpass", "-Rpass-missed", "-Rpass-analysis"};
+
+  for (int kind = 0; kind < N_REMARK_KINDS; kind++) {
+    size_t len = strlen(NAMES[kind]);
+    if (strncmp(arg, NAMES[kind], len) != 0) continue;
+    if (arg[len] != '\0' && arg[len] != '=') continue;
+
+    options->remarks[kind] = true;
+    options->remarkFilters[kind] = arg[len] == '=' ? arg + len + 1 : NULL;
+    return true;
+  }
+  return false;
+}
+
+// each callee is listed once; the cache key combines the names with xor, so
+// a name given twice would cancel itself out
+static void add_non_retaining(Options *options, char *callee) {
+  for (int i = 0; i < options->nonRetaining->len; i++) {
+    if (!strcmp(vec_get(options->nonRetaining, i), callee)) return;
+  }
+  vec_push(options->nonRetaining, callee);
+}
+
+static Options *default_options(void) {
+  Options *options = malloc(sizeof(Options));
+  options->path = NULL;
+  options->watch = false;
+  options->convertTo = NULL;
+  options->astCacheDir = NULL;
+  options->emit = EMIT_VM;
+  long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  options->jobs = cpus > 0 ? (int) cpus : 1;
+  options->optLevel = OPT_O0;
+  options->passFlags = new_vec();
+  options->timePasses = false;
+  for (int i = 0; i < N_REMARK_KINDS; i++) {
+    options->remarks[i] = false;
+    options->remarkFilters[i] = NULL;
+  }
+  options->passes = NULL;
+  options->nonRetaining = new_vec();
+  vec_push(options->nonRetaining, "Output.printString");
+  vec_push(options->nonRetaining, "Keyboard.readLine");
+  vec_push(options->nonRetaining, "Keyboard.readInt");
+  options->wholeProgram = false;
+  options->roots = new_vec();
+  vec_push(options->roots, "Main.main");
+  vec_push(options->roots, "Sys.init");
+  options->inlineLimit = 16;
+  options->poolStringsLimit = HACK_STATIC_SLOTS;
+  return options;
+}
+
+// compiler [--watch] [--ast-cache <dir>] [--emit vm|vmb|null] [-j<threads>]
+//          [-O0|-O1|-O2|-Os] [-f<pass>|-fno-<pass>] [-finline-limit=<n>] [-fpool-strings-limit=<n>]
+//          [--time-passes]
+//          [-Rpass[=<regex>]] [-Rpass-missed[=<regex>]] [-Rpass-analysis[=<regex>]]
+//          [--non-retaining <Class.function>] [--whole-program [--root <Class.function>]]
+//          <file.jack | directory>
+// compiler --convert <out.vm | out.vmb> <in.vmb | in.vm>
+// returns NULL if the arguments cannot be understood
+Options *parse_options(int argc, char *argv[]) {
+  Options *options = default_options();
+
+  for (int i = 1; i < argc; i++) {
+    char *arg = argv[i];
+
+    if (!strcmp(arg, "--watch")) {
+      options->watch = true;
+      continue;
+    }
+
+    if (!strcmp(arg, "--convert") && i + 1 < argc) {
+      options->convertTo = argv[++i];
+      continue;
+    }
+
+    if (!strcmp(arg, "--ast-cache") && i + 1 < argc) {
+      options->astCacheDir = argv[++i];
+      continue;
+    }
+
+    if (!strcmp(arg, "--emit") && i + 1 < argc) {
+      char *kind = argv[++i];
+      if (!strcmp(kind, "vm")) {
+        options->emit = EMIT_VM;
+      } else if (!strcmp(kind, "vmb")) {
+        options->emit = EMIT_VMB;
+      } else if (!strcmp(kind, "null")) {
+        options->emit = EMIT_NULL;
+      } else {
+        xprintf("unknown output kind %s\n", kind);
+        return NULL;
+      }
+      continue;
+    }
+
+    if (!strncmp(arg, "-j", 2) && (arg[2] != '\0' || i + 1 < argc)) {
+      options->jobs = atoi(arg[2] != '\0' ? arg + 2 : argv[++i]);
+      if (options->jobs < 1) options->jobs = 1;
+      continue;
+    }
+
+    if (!strcmp(arg, "-O0") || !strcmp(arg, "-O1") || !strcmp(arg, "-O2") || !strcmp(arg, "-Os")) {
+      options->optLevel = arg[2] == 's' ? OPT_OS : (OptLevel) (arg[2] - '0');
+      continue;
+    }
+
+    if (!strncmp(arg, "-finline-limit=", 15)) {
+      options->inlineLimit = atoi(arg + 15);
+      if (options->inlineLimit < 0) options->inlineLimit = 0;
+      continue;
+    }
+
+    if (!strncmp(arg, "-fpool-strings-limit=", 21)) {
+      options->poolStringsLimit = atoi(arg + 21);
+      if (options->poolStringsLimit < 0) options->poolStringsLimit = 0;
+      continue;
+    }
+
+    if (!strncmp(arg, "-f", 2) && arg[2] != '\0') {
+      vec_push(options->passFlags, arg + 2);
+      continue;
+    }
+
+    if (!strcmp(arg, "--non-retaining") && i + 1 < argc) {
+      add_non_retaining(options, argv[++i]);
+      continue;
+    }
+
+    if (!strcmp(arg, "--whole-program")) {
+      options->wholeProgram = true;
+      continue;
+    }
+
+    if (!strcmp(arg, "--root") && i + 1 < argc) {
+      vec_push(options->roots, argv[++i]);
+      continue;
+    }
+
+    if (!strcmp(arg, "--time-passes")) {
+      options->timePasses = true;
+      continue;
+    }
+
+    if (parse_remark_option(options, arg)) {
+      continue;
+    }
+
+    if (arg[0] == '-' || options->path != NULL) {
+      xprintf("unknown argument %s\n", arg);
+      return NULL;
+    }
+    options->path = arg;
+  }
+
+  if (options->path == NULL) return NULL;
+
+  options->passes = new_pass_manager(options->optLevel, options->passFlags, options->timePasses);
+  if (options->passes == NULL) return NULL;
+
+  for (int kind = 0; kind < N_REMARK_KINDS; kind++) {
+    if (options->remarks[kind] && !set_remark_filter(options->passes, kind, options->remarkFilters[kind])) {
+      return NULL;
+    }
+  }
+  return options;
+}
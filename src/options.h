@@ -0,0 +1,48 @@
+
+#ifndef COMPILER_OPTIONS_H
+#define COMPILER_OPTIONS_H
+
+#include <stdbool.h>
+#include "pass_manager.h"
+
+typedef enum {
+  EMIT_VM,
+  EMIT_VMB,
+  EMIT_NULL
+} EmitKind;
+
+// command line configuration of a single compiler run
+typedef struct {
+  char *path;
+  bool watch;
+  // compiler --convert <out> <in>: translate between .vm and .vmb
+  char *convertTo;
+  char *astCacheDir;
+  EmitKind emit;
+  int jobs;
+  OptLevel optLevel;
+  // -f<pass> and -fno-<pass> switches, without the leading -f
+  Vector *passFlags;
+  bool timePasses;
+  // -Rpass[=<regex>], -Rpass-missed[=<regex>], -Rpass-analysis[=<regex>]
+  bool remarks[N_REMARK_KINDS];
+  char *remarkFilters[N_REMARK_KINDS];
+  PassManager *passes;
+  // --non-retaining <Class.function>: callees that neither keep nor return
+  // their string arguments, so literals passed to them may be disposed of
+  Vector *nonRetaining;
+  // --whole-program: leave out the subroutines that cannot be reached from
+  // the roots (Main.main, Sys.init and those given with --root <Class.function>)
+  bool wholeProgram;
+  Vector *roots;
+  // -finline-limit=<n>: most commands a call inlined in a whole-program
+  // build may turn into
+  int inlineLimit;
+  // -fpool-strings-limit=<n>: most static slots a class may use, its own
+  // statics and its pooled literals together
+  int poolStringsLimit;
+} Options;
+
+Options *parse_options(int argc, char *argv[]);
+
+#endif //COMPILER_OPTIONS_H
@@ -251,6 +251,7 @@ static void parse_class_var_dec(Tokenizer *tokenizer, SymbolTable *gTable) {
 
 static Function *parse_subroutine(Tokenizer *tokenizer, Class *class) {
   // ('constructor' | 'function' | 'method') ('void' | type) subroutineName '(' parameterList ')' subroutineBody
+  int line = get_line(tokenizer);
   KeyWord funcKind = expect_keyword_n(tokenizer, 3, CONSTRUCTOR, FUNCTION, METHOD);
   char *returnType;
   if (is_equal_to(get_keyword(tokenizer), VOID)) {
@@ -261,6 +262,7 @@ static Function *parse_subroutine(Tokenizer *tokenizer, Class *class) {
 
   char *funcName = expect_identifier(tokenizer);
   Function *func = new_function(funcKind, funcName, returnType);
+  func->line = line;
 
   expect_symbol(tokenizer, '(');
   parse_param_list(tokenizer, func, class->name);
@@ -325,6 +327,7 @@ static Vector *parse_statements(Tokenizer *tokenizer) {
   KeyWord keyWord = get_keyword(tokenizer);
   while(is_one_of(keyWord, 5, LET, IF, WHILE, DO, RETURN)) {
     stmt = malloc(sizeof(Statement));
+    stmt->line = get_line(tokenizer);
     switch (keyWord) {
       case LET: {
         stmt->type = LET_STMT;
@@ -18,6 +18,7 @@ typedef struct Function {
   char *returnType;
   SymbolTable *lTable;
   Vector *statements;
+  int line;
 } Function;
 
 enum TermType {
@@ -118,6 +119,7 @@ typedef struct Statement {
     LetStmt *letStmt;
     DoStmt *doStmt;
   };
+  int line;
 } Statement;
 
 
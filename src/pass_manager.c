@@ -0,0 +1,274 @@
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pass_manager.h"
+#include "passes.h"
+
+static int remove_unreachable(PassContext *ctx);
+
+// every known pass in the order the manager runs them
+static Pass PASSES[] = {
+    {"unreachable", "remove statements that follow a return", PASS_TRANSFORM, STAGE_AST, AT_ALL_OPT, remove_unreachable},
+    {"fold", "evaluate constant expressions and apply algebraic identities", PASS_TRANSFORM, STAGE_AST, AT_ALL_OPT, fold_constants},
+    {"dataflow", "find locals read before they are assigned and variables never read", PASS_ANALYSIS, STAGE_IR, AT_ALL_OPT, analyze_dataflow},
+    {"inline", "replace calls to small subroutines of the program with their bodies", PASS_TRANSFORM, STAGE_IR, AT_O2 | AT_OS, inline_calls},
+    {"strength", "replace multiplications and divisions by constants with doublings and additions", PASS_TRANSFORM, STAGE_IR, AT_O2 | AT_OS, reduce_strength},
+    {"branches", "branch on conditions without negating them where the condition allows", PASS_LOWERING, STAGE_AST, AT_ALL_OPT, NULL},
+    {"rotate-loops", "test while conditions below the loop body so an iteration takes a single branch", PASS_LOWERING, STAGE_AST, AT_O2 | AT_OS, NULL},
+    {"pool-strings", "build each distinct string literal of a class once and reuse it", PASS_LOWERING, STAGE_AST, 0, NULL},
+    {"dispose-strings", "dispose of string literals passed to callees that do not keep them", PASS_LOWERING, STAGE_AST, 0, NULL},
+    {"array-offsets", "address elements with constant indices through the that segment and reuse pointer 1", PASS_TRANSFORM, STAGE_IR, AT_ALL_OPT, fold_array_offsets},
+    {"cse", "compute repeated pure expressions once, keeping their values in free temps", PASS_TRANSFORM, STAGE_IR, AT_O2 | AT_OS, eliminate_common_subexpressions},
+    {"copies", "read the source of a copy to a local or argument instead of the copy", PASS_TRANSFORM, STAGE_IR, AT_O2 | AT_OS, propagate_copies},
+    {"dead-stores", "remove stores to locals and arguments that are never read", PASS_TRANSFORM, STAGE_IR, AT_ALL_OPT, eliminate_dead_stores},
+    {"allocate-locals", "give locals that are never live at once the same slot and drop unused ones", PASS_TRANSFORM, STAGE_IR, AT_ALL_OPT, allocate_locals},
+    {"peephole", "rewrite short command sequences by a table of rules", PASS_TRANSFORM, STAGE_IR, AT_ALL_OPT, peephole},
+};
+
+#define N_PASSES ((int) (sizeof(PASSES) / sizeof(PASSES[0])))
+
+static int find_pass(char *name) {
+  for (int i = 0; i < N_PASSES; i++) {
+    if (!strcmp(PASSES[i].name, name)) return i;
+  }
+  return -1;
+}
+
+// passFlags holds the -f<pass> / -fno-<pass> switches without the -f, in
+// command line order; they are applied on top of the -O preset
+PassManager *new_pass_manager(OptLevel level, Vector *passFlags, bool timePasses) {
+  PassManager *pm = malloc(sizeof(PassManager));
+  pm->level = level;
+  pm->passes = new_vec();
+  pm->enabled = malloc(sizeof(bool) * N_PASSES);
+  pm->stats = calloc(N_PASSES, sizeof(PassStats));
+  pm->timePasses = timePasses;
+  for (int i = 0; i < N_REMARK_KINDS; i++) {
+    pm->remarks[i] = false;
+  }
+  pthread_mutex_init(&pm->lock, NULL);
+
+  for (int i = 0; i < N_PASSES; i++) {
+    vec_push(pm->passes, &PASSES[i]);
+    pm->enabled[i] = (PASSES[i].levels & (1 << level)) != 0;
+  }
+
+  for (int i = 0; passFlags != NULL && i < passFlags->len; i++) {
+    char *flag = vec_get(passFlags, i);
+    bool enable = strncmp(flag, "no-", 3) != 0;
+    int index = find_pass(enable ? flag : flag + 3);
+
+    if (index == -1) {
+      xprintf("unknown pass %s\n", enable ? flag : flag + 3);
+      return NULL;
+    }
+    pm->enabled[index] = enable;
+  }
+
+  return pm;
+}
+
+// pattern is an extended regular expression matched against pass names,
+// NULL selects every pass
+bool set_remark_filter(PassManager *pm, RemarkKind kind, char *pattern) {
+  if (pm->remarks[kind]) {
+    regfree(&pm->remarkFilter[kind]);
+    pm->remarks[kind] = false;
+  }
+
+  if (regcomp(&pm->remarkFilter[kind], pattern != NULL ? pattern : "", REG_EXTENDED | REG_NOSUB) != 0) {
+    xprintf("invalid remark filter %s\n", pattern);
+    return false;
+  }
+  pm->remarks[kind] = true;
+  return true;
+}
+
+bool pass_enabled(PassManager *pm, char *name) {
+  if (pm == NULL) return false;
+  int index = find_pass(name);
+  return index != -1 && pm->enabled[index];
+}
+
+// identifies the set of enabled passes and the level, so that cached code
+// generated with other settings is not reused; -O2 and -Os enable the same
+// passes but tune them differently
+uint64_t pass_config(PassManager *pm) {
+  if (pm == NULL) return 0;
+  uint64_t config = hash_bytes((char *) &pm->level, sizeof(pm->level));
+  for (int i = 0; i < N_PASSES; i++) {
+    if (pm->enabled[i]) config ^= hash_bytes(PASSES[i].name, strlen(PASSES[i].name));
+  }
+  return config;
+}
+
+bool remarks_requested(PassManager *pm) {
+  for (int i = 0; pm != NULL && i < N_REMARK_KINDS; i++) {
+    if (pm->remarks[i]) return true;
+  }
+  return false;
+}
+
+bool remarks_wanted(PassContext *ctx, RemarkKind kind) {
+  PassManager *pm = ctx->pm;
+  return pm->remarks[kind] && regexec(&pm->remarkFilter[kind], PASSES[ctx->pass].name, 0, NULL, 0) == 0;
+}
+
+static void write_json_string(FILE *out, char *str) {
+  fputc('"', out);
+  for (char *c = str; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\') {
+      fprintf(out, "\\%c", *c);
+    } else if ((unsigned char) *c < 0x20) {
+      fprintf(out, "\\u%04x", *c);
+    } else {
+      fputc(*c, out);
+    }
+  }
+  fputc('"', out);
+}
+
+// one JSON object per line on stderr, e.g.
+// {"kind":"passed","pass":"unreachable","class":"Main","function":"run","line":12,
+//  "message":"removed 2 statements after return","savings":9}
+// savings is the estimated number of VM commands the transformation saves
+void pass_remark(PassContext *ctx, RemarkKind kind, int line, long savings, char *format, ...) {
+  if (!remarks_wanted(ctx, kind)) return;
+
+  static const char *KINDS[] = {"passed", "missed", "analysis"};
+  char message[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+
+  // the whole line is written at once, so remarks of parallel workers never interleave
+  pthread_mutex_lock(&ctx->pm->lock);
+  fprintf(stderr, "{\"kind\":\"%s\",\"pass\":", KINDS[kind]);
+  write_json_string(stderr, PASSES[ctx->pass].name);
+  fprintf(stderr, ",\"class\":");
+  write_json_string(stderr, ctx->class->name);
+  fprintf(stderr, ",\"function\":");
+  write_json_string(stderr, ctx->func->name);
+  fprintf(stderr, ",\"line\":%i,\"message\":", line);
+  write_json_string(stderr, message);
+  fprintf(stderr, ",\"savings\":%ld}\n", savings);
+  pthread_mutex_unlock(&ctx->pm->lock);
+}
+
+// where a lowering pass, which code generation runs itself, reports
+PassContext pass_context(PassManager *pm, char *name, Class *class, Function *func) {
+  PassContext ctx = {pm, class, func, NULL, NULL, NULL, find_pass(name)};
+  return ctx;
+}
+
+static double now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// commands of the subroutine at the current stage
+static long code_size(PassContext *ctx) {
+  if (ctx->ir != NULL) return ctx->ir->len;
+  return ctx->measure->function(ctx->measure->arg, ctx->func);
+}
+
+// may be called from several code generation threads at once
+static void run_stage(PassContext *ctx, PassStage stage) {
+  PassManager *pm = ctx->pm;
+  long size = pm->timePasses ? code_size(ctx) : 0;
+
+  for (int i = 0; i < N_PASSES; i++) {
+    Pass *pass = &PASSES[i];
+    if (!pm->enabled[i] || pass->run == NULL || pass->stage != stage) continue;
+
+    ctx->pass = i;
+    double start = now_ms();
+    int changes = pass->run(ctx);
+    double ms = now_ms() - start;
+
+    long removed = 0;
+    if (pm->timePasses && pass->kind == PASS_TRANSFORM && changes > 0) {
+      long newSize = code_size(ctx);
+      removed = size - newSize;
+      size = newSize;
+    }
+
+    pthread_mutex_lock(&pm->lock);
+    pm->stats[i].runs++;
+    pm->stats[i].changes += changes;
+    pm->stats[i].removed += removed;
+    pm->stats[i].ms += ms;
+    pthread_mutex_unlock(&pm->lock);
+  }
+}
+
+void run_ast_passes(PassManager *pm, Class *class, Function *func, Measure *measure) {
+  PassContext ctx = {pm, class, func, measure, NULL, NULL, 0};
+  run_stage(&ctx, STAGE_AST);
+}
+
+void run_ir_passes(PassManager *pm, Class *class, Function *func, IrFunction *ir, InlineTable *inlines) {
+  PassContext ctx = {pm, class, func, NULL, ir, inlines, 0};
+  run_stage(&ctx, STAGE_IR);
+}
+
+void print_pass_report(PassManager *pm) {
+  if (pm == NULL || !pm->timePasses) return;
+
+  static const char *LEVELS[] = {"-O0", "-O1", "-O2", "-Os"};
+  fprintf(stderr, "===== pass report (%s) =====\n", LEVELS[pm->level]);
+  fprintf(stderr, "%-20s %8s %8s %10s %14s\n", "pass", "runs", "changes", "time (ms)", "instr removed");
+
+  double total = 0;
+  for (int i = 0; i < N_PASSES; i++) {
+    if (!pm->enabled[i] || PASSES[i].run == NULL) continue;
+    PassStats *stats = &pm->stats[i];
+    fprintf(stderr, "%-20s %8ld %8ld %10.3f %14ld\n", PASSES[i].name, stats->runs, stats->changes, stats->ms, stats->removed);
+    total += stats->ms;
+  }
+  fprintf(stderr, "%-20s %8s %8s %10.3f\n", "total", "", "", total);
+
+  if (pass_enabled(pm, "peephole")) {
+    print_peephole_hits();
+  }
+}
+
+/*============================ Passes ============================ */
+
+static int truncate_after_return(PassContext *ctx, Vector *stmts) {
+  if (stmts == NULL) return 0;
+
+  int changes = 0;
+  for (int i = 0; i < stmts->len; i++) {
+    Statement *stmt = vec_get(stmts, i);
+    if (stmt->type == IF_STMT) {
+      changes += truncate_after_return(ctx, stmt->ifStmt->ifStmts);
+      changes += truncate_after_return(ctx, stmt->ifStmt->elseStmts);
+    } else if (stmt->type == WHILE_STMT) {
+      changes += truncate_after_return(ctx, stmt->whileStmt->stmts);
+    } else if (stmt->type == RETURN_STMT && i + 1 < stmts->len) {
+      int removed = stmts->len - i - 1;
+      if (remarks_wanted(ctx, REMARK_PASSED)) {
+        // the statements that are about to be dropped
+        Vector dead = {stmts->data + i + 1, removed, removed};
+        Statement *first = vec_get(stmts, i + 1);
+        long savings = ctx->measure->statements(ctx->measure->arg, ctx->func, &dead);
+        pass_remark(ctx, REMARK_PASSED, first->line, savings,
+                    "removed %i statement%s after the return on line %i", removed, removed == 1 ? "" : "s", stmt->line);
+      }
+      changes += removed;
+      stmts->len = i + 1;
+      break;
+    }
+  }
+  return changes;
+}
+
+static int remove_unreachable(PassContext *ctx) {
+  return truncate_after_return(ctx, ctx->func->statements);
+}
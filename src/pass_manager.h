@@ -0,0 +1,117 @@
+
+#ifndef COMPILER_PASS_MANAGER_H
+#define COMPILER_PASS_MANAGER_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <regex.h>
+#include "util.h"
+#include "parser.h"
+#include "vm_ir.h"
+
+typedef enum {
+  OPT_O0,
+  OPT_O1,
+  OPT_O2,
+  OPT_OS
+} OptLevel;
+
+#define AT_O1 (1 << OPT_O1)
+#define AT_O2 (1 << OPT_O2)
+#define AT_OS (1 << OPT_OS)
+#define AT_ALL_OPT (AT_O1 | AT_O2 | AT_OS)
+
+typedef enum {
+  PASS_ANALYSIS,
+  PASS_TRANSFORM,
+  // not run by the manager; code generation asks whether it is enabled
+  PASS_LOWERING
+} PassKind;
+
+// passes either rewrite the AST before code generation or the IR of a
+// subroutine before it is printed
+typedef enum {
+  STAGE_AST,
+  STAGE_IR
+} PassStage;
+
+typedef enum {
+  // a transformation was applied
+  REMARK_PASSED,
+  // a transformation was considered but not applied
+  REMARK_MISSED,
+  // a fact the pass found that does not change the code
+  REMARK_ANALYSIS
+} RemarkKind;
+
+#define N_REMARK_KINDS 3
+
+typedef struct PassManager PassManager;
+// defined in inliner.h
+typedef struct InlineTable InlineTable;
+
+// counts the commands generated for a subroutine or for some of its
+// statements; supplied by the code generator
+typedef struct {
+  long (*function)(void *arg, Function *func);
+  long (*statements)(void *arg, Function *func, Vector *stmts);
+  void *arg;
+} Measure;
+
+// what a pass works on and where it reports
+typedef struct {
+  PassManager *pm;
+  Class *class;
+  Function *func;
+  // only for AST passes
+  Measure *measure;
+  // only for IR passes
+  IrFunction *ir;
+  // in whole-program builds, the subroutines calls may be inlined from
+  InlineTable *inlines;
+  // index of the running pass
+  int pass;
+} PassContext;
+
+typedef struct {
+  char *name;
+  char *description;
+  PassKind kind;
+  PassStage stage;
+  int levels;
+  // returns the number of changes made
+  int (*run)(PassContext *ctx);
+} Pass;
+
+typedef struct {
+  long runs;
+  long changes;
+  long removed;
+  double ms;
+} PassStats;
+
+struct PassManager {
+  OptLevel level;
+  Vector *passes;
+  bool *enabled;
+  PassStats *stats;
+  bool timePasses;
+  // remarks of each kind are written for the passes whose name matches
+  bool remarks[N_REMARK_KINDS];
+  regex_t remarkFilter[N_REMARK_KINDS];
+  pthread_mutex_t lock;
+};
+
+PassManager *new_pass_manager(OptLevel level, Vector *passFlags, bool timePasses);
+bool set_remark_filter(PassManager *pm, RemarkKind kind, char *pattern);
+bool pass_enabled(PassManager *pm, char *name);
+bool remarks_requested(PassManager *pm);
+bool remarks_wanted(PassContext *ctx, RemarkKind kind);
+void pass_remark(PassContext *ctx, RemarkKind kind, int line, long savings, char *format, ...);
+PassContext pass_context(PassManager *pm, char *name, Class *class, Function *func);
+uint64_t pass_config(PassManager *pm);
+void run_ast_passes(PassManager *pm, Class *class, Function *func, Measure *measure);
+void run_ir_passes(PassManager *pm, Class *class, Function *func, IrFunction *ir, InlineTable *inlines);
+void print_pass_report(PassManager *pm);
+
+#endif //COMPILER_PASS_MANAGER_H
@@ -0,0 +1,21 @@
+
+#ifndef COMPILER_PASSES_H
+#define COMPILER_PASSES_H
+
+#include "pass_manager.h"
+
+// the passes that live in their own files; each returns the number of changes
+int fold_constants(PassContext *ctx);
+int analyze_dataflow(PassContext *ctx);
+int inline_calls(PassContext *ctx);
+int reduce_strength(PassContext *ctx);
+int fold_array_offsets(PassContext *ctx);
+int eliminate_common_subexpressions(PassContext *ctx);
+int propagate_copies(PassContext *ctx);
+int eliminate_dead_stores(PassContext *ctx);
+int allocate_locals(PassContext *ctx);
+int peephole(PassContext *ctx);
+
+void print_peephole_hits(void);
+
+#endif //COMPILER_PASSES_H
@@ -0,0 +1,148 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "passes.h"
+#include "peephole.h"
+
+#define IS_VAR(x) ((x) > INT_MIN && (x) <= VAR(N_VARS - 1))
+
+// segments, indices and labels
+#define SEG_A VAR(0)
+#define SEG_B VAR(1)
+#define IDX_M VAR(2)
+#define IDX_N VAR(3)
+#define LABEL_L VAR(4)
+#define LABEL_M VAR(5)
+
+#define PUSH(seg, idx) {IR_PUSH, seg, idx, ANY}
+#define POP(seg, idx) {IR_POP, seg, idx, ANY}
+#define ARITH(command) {IR_ARITHMETIC, command, ANY, ANY}
+#define LABEL(label) {IR_LABEL, ANY, ANY, label}
+#define GOTO(label) {IR_GOTO, ANY, ANY, label}
+#define IF_GOTO(label) {IR_IF_GOTO, ANY, ANY, label}
+#define RETURN {IR_RETURN, ANY, ANY, ANY}
+#define ANY_COMMAND {ANY, ANY, ANY, ANY}
+#define NOTHING {{0}}
+
+// code after an unconditional jump runs only if it is a jump target
+static bool unreachable(IrInstr *window) {
+  return window[1].op != IR_LABEL && window[1].op != IR_FUNCTION;
+}
+
+// storing the value again changes nothing as long as the first store did not
+// change the value itself: through the pointer it was read with, or by aliasing
+static bool same_store(IrInstr *window) {
+  Segment from = window[0].arg, to = window[1].arg;
+  bool viaPointer = from == SEGMENT_THIS || from == SEGMENT_THAT;
+  return !(viaPointer && (to == SEGMENT_POINTER || to == SEGMENT_THIS || to == SEGMENT_THAT));
+}
+
+const Rule PEEPHOLE_RULES[] = {
+    {"push-pop", 2, {PUSH(SEG_A, IDX_M), POP(SEG_A, IDX_M)}, 0, NOTHING, NULL},
+    {"double-not", 2, {ARITH(NOT), ARITH(NOT)}, 0, NOTHING, NULL},
+    {"double-neg", 2, {ARITH(NEG), ARITH(NEG)}, 0, NOTHING, NULL},
+    {"neg-zero", 2, {PUSH(SEGMENT_CONST, 0), ARITH(NEG)}, 1, {PUSH(SEGMENT_CONST, 0)}, NULL},
+    {"add-zero", 2, {PUSH(SEGMENT_CONST, 0), ARITH(ADD)}, 0, NOTHING, NULL},
+    {"sub-zero", 2, {PUSH(SEGMENT_CONST, 0), ARITH(SUB)}, 0, NOTHING, NULL},
+    {"or-zero", 2, {PUSH(SEGMENT_CONST, 0), ARITH(OR)}, 0, NOTHING, NULL},
+    {"not-true", 3, {PUSH(SEGMENT_CONST, 1), ARITH(NEG), ARITH(NOT)}, 1, {PUSH(SEGMENT_CONST, 0)}, NULL},
+    {"if-true", 3, {PUSH(SEGMENT_CONST, 1), ARITH(NEG), IF_GOTO(LABEL_L)}, 1, {GOTO(LABEL_L)}, NULL},
+    {"if-not-zero", 3, {PUSH(SEGMENT_CONST, 0), ARITH(NOT), IF_GOTO(LABEL_L)}, 1, {GOTO(LABEL_L)}, NULL},
+    {"if-false", 2, {PUSH(SEGMENT_CONST, 0), IF_GOTO(LABEL_L)}, 0, NOTHING, NULL},
+    {"goto-next", 2, {GOTO(LABEL_L), LABEL(LABEL_L)}, 1, {LABEL(LABEL_L)}, NULL},
+    {"goto-over-label", 3, {GOTO(LABEL_L), LABEL(LABEL_M), LABEL(LABEL_L)}, 2, {LABEL(LABEL_M), LABEL(LABEL_L)}, NULL},
+    {"dead-after-goto", 2, {GOTO(LABEL_L), ANY_COMMAND}, 1, {GOTO(LABEL_L)}, unreachable},
+    {"dead-after-return", 2, {RETURN, ANY_COMMAND}, 1, {RETURN}, unreachable},
+    {"repeated-store", 4, {PUSH(SEG_A, IDX_M), POP(SEG_B, IDX_N), PUSH(SEG_A, IDX_M), POP(SEG_B, IDX_N)},
+     2, {PUSH(SEG_A, IDX_M), POP(SEG_B, IDX_N)}, same_store},
+};
+
+#define N_RULES ((int) (sizeof(PEEPHOLE_RULES) / sizeof(PEEPHOLE_RULES[0])))
+
+const int N_PEEPHOLE_RULES = N_RULES;
+
+// hits of every rule over the whole run, guarded by the lock of the pass manager
+static long hits[N_RULES];
+
+/*============================ Matching ============================ */
+
+static bool match_field(int field, int value, int *bindings, bool *bound) {
+  if (field == ANY) return true;
+  if (!IS_VAR(field)) return field == value;
+
+  int var = field - VAR(0);
+  if (!bound[var]) {
+    bindings[var] = value;
+    bound[var] = true;
+    return true;
+  }
+  return bindings[var] == value;
+}
+
+bool peephole_match(const Rule *rule, IrInstr *window, int *bindings) {
+  bool bound[N_VARS] = {false};
+  for (int i = 0; i < rule->len; i++) {
+    const Template *t = &rule->pattern[i];
+    IrInstr *instr = &window[i];
+    if (!match_field(t->op, instr->op, bindings, bound) || !match_field(t->arg, instr->arg, bindings, bound) ||
+        !match_field(t->operand, instr->operand, bindings, bound) || !match_field(t->name, instr->name, bindings, bound)) {
+      return false;
+    }
+  }
+  return rule->applies == NULL || rule->applies(window);
+}
+
+static int instantiate_field(int field, int *bindings, int unset) {
+  if (field == ANY) return unset;
+  return IS_VAR(field) ? bindings[field - VAR(0)] : field;
+}
+
+int peephole_instantiate(const Template *templates, int len, int *bindings, IrInstr *code) {
+  for (int i = 0; i < len; i++) {
+    const Template *t = &templates[i];
+    code[i] = ir_instr(instantiate_field(t->op, bindings, 0), instantiate_field(t->arg, bindings, 0),
+                       instantiate_field(t->operand, bindings, 0), instantiate_field(t->name, bindings, -1));
+  }
+  return len;
+}
+
+int peephole(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  long ruleHits[N_RULES] = {0};
+  int changes = 0;
+
+  for (int i = 1; i < ir->len; i++) {
+    for (int r = 0; r < N_RULES; r++) {
+      const Rule *rule = &PEEPHOLE_RULES[r];
+      int bindings[N_VARS];
+      if (i + rule->len > ir->len || !peephole_match(rule, &ir->code[i], bindings)) continue;
+
+      pass_remark(ctx, REMARK_PASSED, ir->lines[i], rule->len - rule->replacementLen, "applied %s", rule->name);
+      IrInstr replacement[MAX_WINDOW];
+      int len = peephole_instantiate(rule->replacement, rule->replacementLen, bindings, replacement);
+      ir_replace(ir, i, rule->len, replacement, len);
+      ruleHits[r]++;
+      changes++;
+
+      // the replacement may complete a pattern that starts a little earlier
+      i = i - MAX_WINDOW > 0 ? i - MAX_WINDOW : 0;
+      break;
+    }
+  }
+
+  if (changes > 0) {
+    pthread_mutex_lock(&ctx->pm->lock);
+    for (int r = 0; r < N_RULES; r++) {
+      hits[r] += ruleHits[r];
+    }
+    pthread_mutex_unlock(&ctx->pm->lock);
+  }
+  return changes;
+}
+
+void print_peephole_hits(void) {
+  fprintf(stderr, "%-20s %8s\n", "peephole rule", "hits");
+  for (int r = 0; r < N_RULES; r++) {
+    fprintf(stderr, "%-20s %8ld\n", PEEPHOLE_RULES[r].name, hits[r]);
+  }
+}
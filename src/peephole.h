@@ -0,0 +1,42 @@
+
+#ifndef COMPILER_PEEPHOLE_H
+#define COMPILER_PEEPHOLE_H
+
+#include <limits.h>
+#include <stdbool.h>
+#include "vm_ir.h"
+
+// A rule replaces a short window of commands by an equivalent shorter one.
+// Fields of a pattern are either exact, ANY or a variable that has to be
+// the same wherever it appears; the replacement uses the bound variables.
+#define ANY INT_MIN
+#define VAR(i) (INT_MIN + 1 + (i))
+#define N_VARS 6
+
+#define MAX_WINDOW 4
+
+typedef struct {
+  int op;
+  int arg;
+  int operand;
+  int name;
+} Template;
+
+typedef struct {
+  char *name;
+  int len;
+  Template pattern[MAX_WINDOW];
+  int replacementLen;
+  Template replacement[MAX_WINDOW];
+  // an extra condition on the matched commands, NULL if there is none
+  bool (*applies)(IrInstr *window);
+} Rule;
+
+extern const Rule PEEPHOLE_RULES[];
+extern const int N_PEEPHOLE_RULES;
+
+// binds the variables of the rule if it matches the window
+bool peephole_match(const Rule *rule, IrInstr *window, int *bindings);
+int peephole_instantiate(const Template *templates, int len, int *bindings, IrInstr *code);
+
+#endif //COMPILER_PEEPHOLE_H
@@ -0,0 +1,385 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "signature_index.h"
+
+#define SIGNATURE_INDEX_VERSION 1
+
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourcesHash;
+  uint64_t hash;
+  uint64_t size;
+  uint32_t count;
+  uint32_t strings;
+} SignatureHeader;
+
+/*============================ Header scan ============================ */
+
+// reads just enough of the Jack syntax to find the class and subroutine
+// headers; anything it does not understand is left to the parser to report
+typedef struct {
+  char *pos;
+  char *end;
+  // the last word or symbol
+  char word[256];
+  bool isWord;
+} Scanner;
+
+static bool next(Scanner *sc) {
+  while (sc->pos < sc->end) {
+    char c = *sc->pos;
+
+    if (isspace((unsigned char) c)) {
+      sc->pos++;
+    } else if (c == '/' && sc->pos + 1 < sc->end && sc->pos[1] == '/') {
+      while (sc->pos < sc->end && *sc->pos != '\n') sc->pos++;
+    } else if (c == '/' && sc->pos + 1 < sc->end && sc->pos[1] == '*') {
+      sc->pos += 2;
+      while (sc->pos + 1 < sc->end && !(sc->pos[0] == '*' && sc->pos[1] == '/')) sc->pos++;
+      sc->pos += 2;
+    } else if (c == '"') {
+      sc->pos++;
+      while (sc->pos < sc->end && *sc->pos != '"') sc->pos++;
+      sc->pos++;
+    } else {
+      break;
+    }
+  }
+  if (sc->pos >= sc->end) return false;
+
+  char c = *sc->pos;
+  if (isalnum((unsigned char) c) || c == '_') {
+    size_t len = 0;
+    while (sc->pos < sc->end && (isalnum((unsigned char) *sc->pos) || *sc->pos == '_')) {
+      if (len + 1 < sizeof(sc->word)) sc->word[len++] = *sc->pos;
+      sc->pos++;
+    }
+    sc->word[len] = '\0';
+    sc->isWord = true;
+  } else {
+    sc->word[0] = c;
+    sc->word[1] = '\0';
+    sc->isWord = false;
+    sc->pos++;
+  }
+  return true;
+}
+
+static bool is_symbol(Scanner *sc, char symbol) {
+  return !sc->isWord && sc->word[0] == symbol;
+}
+
+static KeyWord subroutine_kind(char *word) {
+  if (!strcmp(word, "constructor")) return CONSTRUCTOR;
+  if (!strcmp(word, "function")) return FUNCTION;
+  if (!strcmp(word, "method")) return METHOD;
+  return (KeyWord) -1;
+}
+
+// ('constructor' | 'function' | 'method') type name '(' parameterList ')'
+// with the scanner on the keyword; NULL if the header is malformed
+static SubroutineHeader *scan_subroutine(Scanner *sc, KeyWord kind) {
+  SubroutineHeader *sub = malloc(sizeof(SubroutineHeader));
+  sub->kind = kind;
+  sub->nParams = 0;
+
+  if (!next(sc) || !sc->isWord) return NULL;
+  sub->returnType = strdup(sc->word);
+  if (!next(sc) || !sc->isWord) return NULL;
+  sub->name = strdup(sc->word);
+  if (!next(sc) || !is_symbol(sc, '(')) return NULL;
+
+  bool empty = true;
+  while (next(sc) && !is_symbol(sc, ')')) {
+    if (empty) sub->nParams = 1;
+    empty = false;
+    if (is_symbol(sc, ',')) sub->nParams++;
+  }
+  return sub;
+}
+
+ClassHeader *scan_class_header(char *source, size_t len) {
+  Scanner sc = {source, source + len};
+  ClassHeader *class = malloc(sizeof(ClassHeader));
+  class->name = NULL;
+  class->subroutines = new_vec();
+
+  int depth = 0;
+  while (next(&sc)) {
+    if (is_symbol(&sc, '{')) {
+      depth++;
+    } else if (is_symbol(&sc, '}')) {
+      depth--;
+    } else if (depth == 0 && sc.isWord && !strcmp(sc.word, "class") && class->name == NULL) {
+      if (next(&sc) && sc.isWord) class->name = strdup(sc.word);
+    } else if (depth == 1 && sc.isWord && subroutine_kind(sc.word) != (KeyWord) -1) {
+      SubroutineHeader *sub = scan_subroutine(&sc, subroutine_kind(sc.word));
+      if (sub != NULL) vec_push(class->subroutines, sub);
+    }
+  }
+
+  return class;
+}
+
+bool same_class_header(ClassHeader *a, ClassHeader *b) {
+  if (a == NULL || b == NULL) return a == b;
+  if ((a->name == NULL) != (b->name == NULL)) return false;
+  if (a->name != NULL && strcmp(a->name, b->name) != 0) return false;
+  if (a->subroutines->len != b->subroutines->len) return false;
+
+  for (int i = 0; i < a->subroutines->len; i++) {
+    SubroutineHeader *x = vec_get(a->subroutines, i);
+    SubroutineHeader *y = vec_get(b->subroutines, i);
+    if (x->kind != y->kind || x->nParams != y->nParams || strcmp(x->name, y->name) != 0
+        || strcmp(x->returnType, y->returnType) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*============================ Index image ============================ */
+
+typedef struct {
+  char *className;
+  char *name;
+  char *returnType;
+  KeyWord kind;
+  int nParams;
+} Entry;
+
+static int compare_entries(const void *a, const void *b) {
+  const Entry *x = a, *y = b;
+  int cmp = strcmp(x->className, y->className);
+  return cmp != 0 ? cmp : strcmp(x->name, y->name);
+}
+
+static uint32_t put_string(StringBuilder *strings, char *str) {
+  if (str == NULL || *str == '\0') return 0;
+  uint32_t offset = strings->len;
+  sb_append(strings, str);
+  sb_add(strings, '\0');
+  return offset;
+}
+
+static void attach_image(SignatureIndex *index, char *image, size_t len, bool mapped) {
+  SignatureHeader *hdr = (SignatureHeader *) image;
+  index->image = image;
+  index->len = len;
+  index->mapped = mapped;
+  index->sourcesHash = hdr->sourcesHash;
+  index->hash = hdr->hash;
+  index->count = hdr->count;
+  index->records = (Signature *) (image + sizeof(SignatureHeader));
+  index->strings = image + hdr->strings;
+}
+
+SignatureIndex *new_signature_index(ClassHeader **classes, int n) {
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    if (classes[i]->name != NULL) count += 1 + classes[i]->subroutines->len;
+  }
+
+  Entry *entries = malloc(sizeof(Entry) * (count > 0 ? count : 1));
+  int len = 0;
+  for (int i = 0; i < n; i++) {
+    ClassHeader *class = classes[i];
+    if (class->name == NULL) continue;
+
+    entries[len++] = (Entry) {class->name, "", NULL, CLASS, 0};
+    for (int j = 0; j < class->subroutines->len; j++) {
+      SubroutineHeader *sub = vec_get(class->subroutines, j);
+      entries[len++] = (Entry) {class->name, sub->name, sub->returnType, sub->kind, sub->nParams};
+    }
+  }
+  qsort(entries, len, sizeof(Entry), compare_entries);
+
+  StringBuilder *strings = new_sb();
+  sb_add(strings, '\0');
+  Signature *records = malloc(sizeof(Signature) * (len > 0 ? len : 1));
+  for (int i = 0; i < len; i++) {
+    records[i].className = put_string(strings, entries[i].className);
+    records[i].name = put_string(strings, entries[i].name);
+    records[i].returnType = put_string(strings, entries[i].returnType);
+    records[i].kind = entries[i].kind;
+    records[i].nParams = entries[i].nParams;
+  }
+
+  size_t recordsSize = sizeof(Signature) * len;
+  size_t size = sizeof(SignatureHeader) + recordsSize + strings->len;
+  char *image = calloc(1, size);
+  memcpy(image + sizeof(SignatureHeader), records, recordsSize);
+  memcpy(image + sizeof(SignatureHeader) + recordsSize, strings->data, strings->len);
+
+  SignatureHeader *hdr = (SignatureHeader *) image;
+  memcpy(hdr->magic, "JSIG", 4);
+  hdr->version = SIGNATURE_INDEX_VERSION;
+  hdr->sourcesHash = 0;
+  hdr->hash = hash_bytes(image + sizeof(SignatureHeader), size - sizeof(SignatureHeader));
+  hdr->size = size;
+  hdr->count = len;
+  hdr->strings = sizeof(SignatureHeader) + recordsSize;
+
+  free(entries);
+  free(records);
+  free(strings->data);
+  free(strings);
+
+  SignatureIndex *index = malloc(sizeof(SignatureIndex));
+  attach_image(index, image, size, false);
+  return index;
+}
+
+// the headers only depend on the sources, so a warm build with an unchanged
+// set of sources maps the previous index instead of scanning
+uint64_t hash_sources(char **sources, size_t *lens, int n) {
+  uint64_t *hashes = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+  for (int i = 0; i < n; i++) {
+    hashes[i] = hash_bytes(sources[i], lens[i]);
+  }
+  uint64_t hash = hash_bytes((char *) hashes, sizeof(uint64_t) * n);
+  free(hashes);
+  return hash;
+}
+
+typedef struct {
+  char **sources;
+  size_t *lens;
+  ClassHeader **classes;
+  int n;
+  int next;
+  pthread_mutex_t lock;
+} ScanJob;
+
+static void *scan_worker(void *arg) {
+  ScanJob *job = arg;
+
+  while (true) {
+    pthread_mutex_lock(&job->lock);
+    int i = job->next++;
+    pthread_mutex_unlock(&job->lock);
+    if (i >= job->n) break;
+
+    job->classes[i] = scan_class_header(job->sources[i], job->lens[i]);
+  }
+  return NULL;
+}
+
+// every file is scanned independently, so the files are spread over jobs threads
+SignatureIndex *scan_signatures(char **sources, size_t *lens, int n, int jobs) {
+  ScanJob job;
+  job.sources = sources;
+  job.lens = lens;
+  job.classes = malloc(sizeof(ClassHeader *) * (n > 0 ? n : 1));
+  job.n = n;
+  job.next = 0;
+  pthread_mutex_init(&job.lock, NULL);
+
+  int nThreads = jobs < n ? jobs : n;
+  if (nThreads <= 1) {
+    scan_worker(&job);
+  } else {
+    pthread_t threads[nThreads];
+    for (int i = 0; i < nThreads; i++) {
+      pthread_create(&threads[i], NULL, scan_worker, &job);
+    }
+    for (int i = 0; i < nThreads; i++) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+  pthread_mutex_destroy(&job.lock);
+
+  SignatureIndex *index = new_signature_index(job.classes, n);
+  index->sourcesHash = hash_sources(sources, lens, n);
+  ((SignatureHeader *) index->image)->sourcesHash = index->sourcesHash;
+  free(job.classes);
+  return index;
+}
+
+// returns NULL unless the file was built from exactly these sources
+SignatureIndex *load_signature_index(char *path, uint64_t sourcesHash) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat statbuf;
+  if (fstat(fd, &statbuf) != 0 || statbuf.st_size < (off_t) sizeof(SignatureHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = statbuf.st_size;
+  char *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) return NULL;
+
+  SignatureHeader *hdr = (SignatureHeader *) image;
+  bool valid = !memcmp(hdr->magic, "JSIG", 4) && hdr->version == SIGNATURE_INDEX_VERSION
+               && hdr->sourcesHash == sourcesHash && hdr->size == size
+               && hdr->strings >= sizeof(SignatureHeader) && hdr->strings < size && image[size - 1] == '\0'
+               && hdr->count <= (hdr->strings - sizeof(SignatureHeader)) / sizeof(Signature);
+  if (!valid) {
+    munmap(image, size);
+    return NULL;
+  }
+
+  SignatureIndex *index = malloc(sizeof(SignatureIndex));
+  attach_image(index, image, size, true);
+
+  size_t nStrings = size - hdr->strings;
+  for (uint32_t i = 0; i < index->count; i++) {
+    Signature *sig = &index->records[i];
+    if (sig->className >= nStrings || sig->name >= nStrings || sig->returnType >= nStrings) {
+      munmap(image, size);
+      free(index);
+      return NULL;
+    }
+  }
+  return index;
+}
+
+char *signature_index_path(char *cacheDir) {
+  StringBuilder *sb = new_sb();
+  sb_concat_strings(sb, 2, cacheDir, "/program.jsig");
+  char *path = sb_get(sb);
+  free(sb);
+  return path;
+}
+
+/*============================ Lookup ============================ */
+
+char *signature_string(SignatureIndex *index, uint32_t offset) {
+  return index->strings + offset;
+}
+
+// the records are sorted by class and then by name, the class record first
+Signature *find_signature(SignatureIndex *index, char *className, char *name) {
+  if (index == NULL) return NULL;
+
+  uint32_t lo = 0, hi = index->count;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    Signature *sig = &index->records[mid];
+    int cmp = strcmp(signature_string(index, sig->className), className);
+    if (cmp == 0) cmp = strcmp(signature_string(index, sig->name), name);
+
+    if (cmp == 0) return sig;
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+bool has_class_signature(SignatureIndex *index, char *className) {
+  return find_signature(index, className, "") != NULL;
+}
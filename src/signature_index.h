@@ -0,0 +1,64 @@
+
+#ifndef COMPILER_SIGNATURE_INDEX_H
+#define COMPILER_SIGNATURE_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "util.h"
+#include "lexer.h"
+
+typedef struct {
+  KeyWord kind;
+  char *returnType;
+  char *name;
+  int nParams;
+} SubroutineHeader;
+
+// the headers found in one source file
+typedef struct {
+  char *name;
+  Vector *subroutines;
+} ClassHeader;
+
+// one class or subroutine record of the index; names are offsets into the string table
+typedef struct {
+  uint32_t className;
+  // 0 (the empty string) for the record of the class itself
+  uint32_t name;
+  uint32_t returnType;
+  // CLASS, CONSTRUCTOR, FUNCTION or METHOD
+  uint16_t kind;
+  uint16_t nParams;
+} Signature;
+
+// The class and subroutine headers of every file of a program, taken by a scan
+// that skips the subroutine bodies. The index is a single image of records
+// sorted by class and subroutine name followed by their strings, so it can be
+// searched in place, shared by any number of code generation threads and
+// written to (and mapped from) a .jsig file as it is.
+typedef struct {
+  char *image;
+  size_t len;
+  bool mapped;
+  // combined hash of the sources the index was built from
+  uint64_t sourcesHash;
+  // changes whenever any signature changes
+  uint64_t hash;
+  Signature *records;
+  uint32_t count;
+  char *strings;
+} SignatureIndex;
+
+ClassHeader *scan_class_header(char *source, size_t len);
+bool same_class_header(ClassHeader *a, ClassHeader *b);
+SignatureIndex *new_signature_index(ClassHeader **classes, int n);
+SignatureIndex *scan_signatures(char **sources, size_t *lens, int n, int jobs);
+uint64_t hash_sources(char **sources, size_t *lens, int n);
+SignatureIndex *load_signature_index(char *path, uint64_t sourcesHash);
+char *signature_index_path(char *cacheDir);
+
+bool has_class_signature(SignatureIndex *index, char *className);
+Signature *find_signature(SignatureIndex *index, char *className, char *name);
+char *signature_string(SignatureIndex *index, uint32_t offset);
+
+#endif //COMPILER_SIGNATURE_INDEX_H
@@ -0,0 +1,253 @@
+
+#include <stdlib.h>
+#include "passes.h"
+
+// commands a replacement adds to its operand: a pop, 15 bits of 7 commands
+// and a final neg
+#define MAX_EXTRA 112
+
+typedef struct {
+  PassContext *ctx;
+  IrFunction *ir;
+  // scratch temps, -1 if the subroutine uses all of them
+  int temps[2];
+} Reducer;
+
+typedef struct {
+  IrInstr *code;
+  int len;
+} Sequence;
+
+static void emit(Sequence *seq, IrInstr instr) {
+  seq->code[seq->len++] = instr;
+}
+
+static void emit_range(Sequence *seq, IrFunction *ir, int start, int end) {
+  for (int i = start; i < end; i++) {
+    emit(seq, ir->code[i]);
+  }
+}
+
+// the value of a push constant, optionally negated
+static bool constant_range(IrFunction *ir, int start, int end, int *value) {
+  IrInstr *code = &ir->code[start];
+  if (code[0].op != IR_PUSH || code[0].arg != SEGMENT_CONST) return false;
+  if (end - start == 1) {
+    *value = code[0].operand;
+    return true;
+  }
+  if (end - start == 2 && code[1].op == IR_ARITHMETIC && code[1].arg == NEG) {
+    *value = -code[0].operand;
+    return true;
+  }
+  return false;
+}
+
+// the bits that can be set in the value of a range ending in "and" with a
+// non-negative constant; -1 if nothing is known
+static int known_bits(IrFunction *ir, int start, int end) {
+  IrInstr *last = &ir->code[end - 1];
+  if (last->op != IR_ARITHMETIC || last->arg != AND) return -1;
+
+  int right = ir_operand_start(ir, end - 1);
+  int left = right > start ? ir_operand_start(ir, right) : -1;
+  if (left != start) return -1;
+
+  int mask;
+  if (constant_range(ir, right, end - 1, &mask) && mask >= 0) return mask;
+  if (constant_range(ir, left, right, &mask) && mask >= 0) return mask;
+  return -1;
+}
+
+static int highest_bit(int value) {
+  int bit = 0;
+  while (value >> (bit + 1)) bit++;
+  return bit;
+}
+
+/*============================ Multiply ============================ */
+
+// x * k with k > 1 by doubling and adding along the bits of k
+static bool multiply_sequence(Reducer *reducer, Sequence *seq, int start, int end, int k) {
+  IrFunction *ir = reducer->ir;
+  IrInstr src = ir->code[start];
+  bool reusable = end - start == 1 && src.op == IR_PUSH;
+
+  if (!reusable) {
+    if (reducer->temps[0] < 0) return false;
+    emit_range(seq, ir, start, end);
+    emit(seq, ir_instr(IR_POP, SEGMENT_TEMP, reducer->temps[0], -1));
+    src = ir_instr(IR_PUSH, SEGMENT_TEMP, reducer->temps[0], -1);
+  }
+  emit(seq, src);
+
+  int bit = highest_bit(k);
+  for (int i = bit - 1; i >= 0; i--) {
+    if (i == bit - 1) {
+      emit(seq, src);
+    } else {
+      // x is still needed by a lower bit unless they are all clear
+      int temp = !reusable && (k & ((1 << (i + 1)) - 1)) == 0 ? reducer->temps[0] : reducer->temps[1];
+      if (temp < 0) return false;
+      emit(seq, ir_instr(IR_POP, SEGMENT_TEMP, temp, -1));
+      emit(seq, ir_instr(IR_PUSH, SEGMENT_TEMP, temp, -1));
+      emit(seq, ir_instr(IR_PUSH, SEGMENT_TEMP, temp, -1));
+    }
+    emit(seq, ir_instr(IR_ARITHMETIC, ADD, 0, -1));
+
+    if (k & (1 << i)) {
+      emit(seq, src);
+      emit(seq, ir_instr(IR_ARITHMETIC, ADD, 0, -1));
+    }
+  }
+  return true;
+}
+
+static bool reduce_multiply(Reducer *reducer, Sequence *seq, int call, int *start) {
+  IrFunction *ir = reducer->ir;
+  int right = ir_operand_start(ir, call);
+  int left = right > 0 ? ir_operand_start(ir, right) : -1;
+  if (left < 0) return false;
+
+  // the constant side has no effects, so the other operand may go first
+  int k, from, to;
+  if (constant_range(ir, right, call, &k)) {
+    from = left;
+    to = right;
+  } else if (constant_range(ir, left, right, &k)) {
+    from = right;
+    to = call;
+  } else {
+    return false;
+  }
+  *start = left;
+
+  int magnitude = abs(k);
+  if (magnitude == 32768) return false;
+
+  if (magnitude == 0) {
+    // the operand still runs for its effects
+    if (to - from > 1 || ir->code[from].op != IR_PUSH) {
+      if (reducer->temps[0] < 0) return false;
+      emit_range(seq, ir, from, to);
+      emit(seq, ir_instr(IR_POP, SEGMENT_TEMP, reducer->temps[0], -1));
+    }
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_CONST, 0, -1));
+  } else if (magnitude == 1) {
+    emit_range(seq, ir, from, to);
+  } else if (!multiply_sequence(reducer, seq, from, to, magnitude)) {
+    return false;
+  }
+
+  if (k < 0) {
+    emit(seq, ir_instr(IR_ARITHMETIC, NEG, 0, -1));
+  }
+  return true;
+}
+
+/*============================ Divide ============================ */
+
+// x / 2^n for x known to have only the bits of mask, one bit at a time:
+// ((x & 2^i) = 2^i) is -1 when the bit is set, and -1 & 2^(i - n) moves it
+static bool divide_sequence(Reducer *reducer, Sequence *seq, int start, int end, int n, int mask) {
+  IrFunction *ir = reducer->ir;
+  int temp = reducer->temps[0];
+  if (temp < 0) return false;
+
+  emit_range(seq, ir, start, end);
+  emit(seq, ir_instr(IR_POP, SEGMENT_TEMP, temp, -1));
+
+  bool first = true;
+  for (int i = n; i < 15; i++) {
+    if (!(mask & (1 << i))) continue;
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_TEMP, temp, -1));
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_CONST, 1 << i, -1));
+    emit(seq, ir_instr(IR_ARITHMETIC, AND, 0, -1));
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_CONST, 1 << i, -1));
+    emit(seq, ir_instr(IR_ARITHMETIC, EQ, 0, -1));
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_CONST, 1 << (i - n), -1));
+    emit(seq, ir_instr(IR_ARITHMETIC, AND, 0, -1));
+    if (!first) {
+      emit(seq, ir_instr(IR_ARITHMETIC, ADD, 0, -1));
+    }
+    first = false;
+  }
+
+  if (first) {
+    emit(seq, ir_instr(IR_PUSH, SEGMENT_CONST, 0, -1));
+  }
+  return true;
+}
+
+static bool reduce_divide(Reducer *reducer, Sequence *seq, int call, int *start) {
+  IrFunction *ir = reducer->ir;
+  int right = ir_operand_start(ir, call);
+  int left = right > 0 ? ir_operand_start(ir, right) : -1;
+  int k;
+  if (left < 0 || !constant_range(ir, right, call, &k)) return false;
+  if (k < 2 || (k & (k - 1)) != 0) return false;
+  *start = left;
+
+  int mask = known_bits(ir, left, right);
+  if (mask < 0) {
+    pass_remark(reducer->ctx, REMARK_MISSED, ir->lines[call], 0,
+                "division by %i kept since the dividend may be negative", k);
+    return false;
+  }
+  return divide_sequence(reducer, seq, left, right, highest_bit(k), mask);
+}
+
+/*============================ Pass ============================ */
+
+static int free_temp(int *unused) {
+  for (int i = 1; i < 8; i++) {
+    if (*unused & (1 << i)) {
+      *unused &= ~(1 << i);
+      return i;
+    }
+  }
+  return -1;
+}
+
+int reduce_strength(PassContext *ctx) {
+  IrFunction *ir = ctx->ir;
+  Reducer reducer = {ctx, ir, {-1, -1}};
+  int unused = ir_free_temps(ir);
+  reducer.temps[0] = free_temp(&unused);
+  reducer.temps[1] = free_temp(&unused);
+
+  int changes = 0;
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    bool multiply = ir_is_call(ir, instr, "Math", "multiply") && instr->operand == 2;
+    bool divide = ir_is_call(ir, instr, "Math", "divide") && instr->operand == 2;
+    if (!multiply && !divide) continue;
+
+    Sequence seq = {malloc(sizeof(IrInstr) * (i + MAX_EXTRA)), 0};
+    int start = -1;
+    if (multiply ? !reduce_multiply(&reducer, &seq, i, &start) : !reduce_divide(&reducer, &seq, i, &start)) {
+      free(seq.code);
+      continue;
+    }
+
+    int oldLen = i + 1 - start;
+    long before = ir_cost_of(ir, &ir->code[start], oldLen);
+    long after = ir_cost_of(ir, seq.code, seq.len);
+    bool profitable = ctx->pm->level == OPT_OS ? seq.len <= oldLen : after < before;
+    if (!profitable) {
+      pass_remark(ctx, REMARK_MISSED, ir->lines[i], 0, "%s kept: %i commands inline would not pay off",
+                  multiply ? "multiplication" : "division", seq.len);
+      free(seq.code);
+      continue;
+    }
+
+    pass_remark(ctx, REMARK_PASSED, ir->lines[i], oldLen - seq.len,
+                "%s inlined, about %li cycles instead of %li", multiply ? "multiplication" : "division",
+                after, before);
+    ir_replace(ir, start, oldLen, seq.code, seq.len);
+    i = start + seq.len - 1;
+    free(seq.code);
+    changes++;
+  }
+  return changes;
+}
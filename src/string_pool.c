@@ -0,0 +1,131 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "string_pool.h"
+
+static void collect_expression(StringPool *pool, Expression *expr);
+
+static void add_literal(StringPool *pool, char *literal) {
+  if (map_geti(pool->index, literal, 0) != 0) return;
+
+  if (pool->firstSlot + pool->literals->len >= pool->limit) {
+    UnpooledString *unpooled = malloc(sizeof(UnpooledString));
+    unpooled->literal = literal;
+    unpooled->func = pool->curFunc;
+    unpooled->line = pool->curLine;
+    vec_push(pool->unpooled, unpooled);
+    map_puti(pool->index, literal, -1);
+    return;
+  }
+  vec_push(pool->literals, literal);
+  map_puti(pool->index, literal, pool->literals->len);
+  pool->hash = pool->hash * 31 + hash_bytes(literal, strlen(literal) + 1);
+}
+
+static void collect_term(StringPool *pool, Term *term) {
+  switch (term->type) {
+    case TERM_STR:
+      add_literal(pool, term->str);
+      break;
+    case TERM_ARRAY:
+      collect_expression(pool, term->array->expr);
+      break;
+    case TERM_SUB_CALL: {
+      ExpressionList *list = term->subCall->exprList;
+      for (int i = 0; list != NULL && i < list->expressions->len; i++) {
+        collect_expression(pool, vec_get(list->expressions, i));
+      }
+      break;
+    }
+    case TERM_EXPR_PARENS:
+      collect_expression(pool, term->expr);
+      break;
+    case TERM_TERM_PAIR:
+      collect_term(pool, term->termPair->term);
+      break;
+    default:
+      break;
+  }
+}
+
+static void collect_expression(StringPool *pool, Expression *expr) {
+  if (expr == NULL) return;
+  collect_term(pool, expr->firstTerm);
+  for (int i = 0; expr->termPairs != NULL && i < expr->termPairs->len; i++) {
+    TermPair *pair = vec_get(expr->termPairs, i);
+    collect_term(pool, pair->term);
+  }
+}
+
+static void collect_statements(StringPool *pool, Vector *stmts) {
+  for (int i = 0; stmts != NULL && i < stmts->len; i++) {
+    Statement *stmt = vec_get(stmts, i);
+    pool->curLine = stmt->line;
+    switch (stmt->type) {
+      case LET_STMT:
+        collect_expression(pool, stmt->letStmt->firstExpr);
+        collect_expression(pool, stmt->letStmt->secondExpr);
+        break;
+      case IF_STMT:
+        collect_expression(pool, stmt->ifStmt->expr);
+        collect_statements(pool, stmt->ifStmt->ifStmts);
+        collect_statements(pool, stmt->ifStmt->elseStmts);
+        break;
+      case WHILE_STMT:
+        collect_expression(pool, stmt->whileStmt->expr);
+        collect_statements(pool, stmt->whileStmt->stmts);
+        break;
+      case RETURN_STMT:
+        collect_expression(pool, stmt->retStmt->expr);
+        break;
+      case DO_STMT: {
+        Term call = {.type = TERM_SUB_CALL, .subCall = stmt->doStmt->call};
+        collect_term(pool, &call);
+        break;
+      }
+    }
+  }
+}
+
+// walks every subroutine in declaration order, so the numbering does not
+// depend on the order they are generated in; limit is the most static slots
+// the class may use, its own statics included
+StringPool *collect_strings(Class *class, int limit) {
+  StringPool *pool = malloc(sizeof(StringPool));
+  pool->literals = new_vec();
+  pool->index = new_map();
+  pool->firstSlot = varCount(class->gTable, KIND_STATIC);
+  pool->limit = limit;
+  pool->unpooled = new_vec();
+  pool->hash = 0;
+
+  for (int i = 0; i < class->functions->len; i++) {
+    Function *func = vec_get(class->functions, i);
+    pool->curFunc = func;
+    pool->curLine = func->line;
+    collect_statements(pool, func->statements);
+  }
+  return pool;
+}
+
+// -1 if the literal is not in the pool
+int string_index(StringPool *pool, char *literal) {
+  int index = map_geti(pool->index, literal, 0);
+  return index > 0 ? index - 1 : -1;
+}
+
+void free_string_pool(StringPool *pool) {
+  free(pool->literals->data);
+  free(pool->literals);
+  for (int i = 0; i < pool->unpooled->len; i++) {
+    free(vec_get(pool->unpooled, i));
+  }
+  free(pool->unpooled->data);
+  free(pool->unpooled);
+  free(pool->index->keys->data);
+  free(pool->index->keys);
+  free(pool->index->vals->data);
+  free(pool->index->vals);
+  free(pool->index);
+  free(pool);
+}
@@ -0,0 +1,42 @@
+
+#ifndef COMPILER_STRING_POOL_H
+#define COMPILER_STRING_POOL_H
+
+#include <stdint.h>
+#include "util.h"
+#include "parser.h"
+
+// the static segment of the Hack platform, RAM 16-255, which all classes share
+#define HACK_STATIC_SLOTS 240
+
+// a literal left out of the pool and where it first appears
+typedef struct {
+  char *literal;
+  Function *func;
+  int line;
+} UnpooledString;
+
+// The distinct string literals of a class in order of first appearance.
+// Literal i is built once by the generated function Class.$string<i> and kept
+// in the static slot firstSlot + i, after the statics the class declares.
+// Literals that would take the class past limit static slots are not pooled.
+typedef struct {
+  Vector *literals;
+  // literal -> index + 1, or -1 if the literal is not pooled
+  Map *index;
+  int firstSlot;
+  int limit;
+  // UnpooledString, in order of first appearance
+  Vector *unpooled;
+  // where the walk is
+  Function *curFunc;
+  int curLine;
+  // changes whenever a literal is added, removed or moved
+  uint64_t hash;
+} StringPool;
+
+StringPool *collect_strings(Class *class, int limit);
+int string_index(StringPool *pool, char *literal);
+void free_string_pool(StringPool *pool);
+
+#endif //COMPILER_STRING_POOL_H
@@ -40,7 +40,7 @@ int varCount(SymbolTable *symbolTable, Kind kind) {
       return symbolTable->varIndex + 1;
     default:
       xprintf("define in symbol_table; unspecified kind");
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -69,7 +69,7 @@ Kind transformToKind(KeyWord keyword) {
       return KIND_VAR;
     default:
       xprintf("transformToKind; incorrect keyword %i", keyword);
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
@@ -94,7 +94,7 @@ static int incr_kind_index(SymbolTable *symbolTable, Kind kind) {
       return ++symbolTable->varIndex;
     default:
       xprintf("define in symbol_table; unspecified kind");
-      exit(EXIT_FAILURE);
+      abort_compilation();
   }
 }
 
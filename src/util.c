@@ -22,6 +22,32 @@ void xprintf(char *format, ...) {
   }
 }
 
+// a long running process (the watch mode) installs a trap so that an error in
+// one class does not terminate it; everywhere else an error ends the program
+static __thread jmp_buf *errorTrap = NULL;
+
+void set_error_trap(jmp_buf *trap) {
+  errorTrap = trap;
+}
+
+void abort_compilation(void) {
+  if (errorTrap != NULL) {
+    xprintf("\n");
+    longjmp(*errorTrap, 1);
+  }
+  exit(EXIT_FAILURE);
+}
+
+// 64-bit FNV-1a
+uint64_t hash_bytes(const char *data, size_t len) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char) data[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
 static int calc_mem_value_for_int(number) {
   if (number == 0)
     return sizeof(char);
@@ -208,6 +234,17 @@ void map_puti(Map *map, char *key, int val) {
   map_put(map, key, (void *) (int) val);
 }
 
+// replaces the value of an existing key instead of shadowing it
+void map_set(Map *map, char *key, void *val) {
+  for (int i = map->keys->len - 1; i >= 0; i--) {
+    if (!strcmp(map->keys->data[i], key)) {
+      map->vals->data[i] = val;
+      return;
+    }
+  }
+  map_put(map, key, val);
+}
+
 void *map_get(Map *map, char *key) {
   for (int i = map->keys->len - 1; i >= 0; i--)
     if (!strcmp(map->keys->data[i], key))
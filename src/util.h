@@ -1,5 +1,8 @@
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <setjmp.h>
 
 #ifndef VIRTUAL_MACHINE_COMMON_H
 #define VIRTUAL_MACHINE_COMMON_H
@@ -37,10 +40,14 @@ void *vec_get(Vector *v, int index);
 Map *new_map(void);
 void map_put(Map *map, char *key, void *val);
 void map_puti(Map *map, char *key, int val);
+void map_set(Map *map, char *key, void *val);
 void *map_get(Map *map, char *key);
 int map_geti(Map *map, char *key, int default_);
 
 void xprintf(char *format, ...);
+void set_error_trap(jmp_buf *trap);
+__attribute__((noreturn)) void abort_compilation(void);
+uint64_t hash_bytes(const char *data, size_t len);
 char *number_to_string(int number);
 
 Vector *split_by(char *str, char delim);
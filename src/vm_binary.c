@@ -0,0 +1,449 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include "vm_binary.h"
+#include "io_batch.h"
+#include "util.h"
+
+#define VMB_VERSION 1
+
+// push and pop add the segment, arithmetic adds the command
+#define OP_PUSH 0x00
+#define OP_POP 0x08
+#define OP_ARITHMETIC 0x10
+#define OP_LABEL 0x20
+#define OP_GOTO 0x21
+#define OP_IF_GOTO 0x22
+#define OP_FUNCTION 0x23
+#define OP_CALL 0x24
+#define OP_RETURN 0x25
+
+/*============================ Binary sink ============================ */
+
+typedef struct {
+  // open addressing, each slot holds a string id + 1
+  int *slots;
+  int capacity;
+  Vector *strings;
+  char *code;
+  size_t codeLen;
+} BinaryState;
+
+static void put_varint(FILE *out, uint32_t value) {
+  while (value >= 0x80) {
+    fputc((value & 0x7f) | 0x80, out);
+    value >>= 7;
+  }
+  fputc(value, out);
+}
+
+static void grow_strings(BinaryState *state) {
+  free(state->slots);
+  state->capacity *= 2;
+  state->slots = calloc(state->capacity, sizeof(int));
+
+  for (int i = 0; i < state->strings->len; i++) {
+    char *str = vec_get(state->strings, i);
+    int slot = hash_bytes(str, strlen(str)) & (state->capacity - 1);
+    while (state->slots[slot] != 0) slot = (slot + 1) & (state->capacity - 1);
+    state->slots[slot] = i + 1;
+  }
+}
+
+// number of str in the string table; str is copied when it is new
+static int intern(BinaryState *state, char *str) {
+  if ((state->strings->len + 1) * 2 > state->capacity) {
+    grow_strings(state);
+  }
+
+  int slot = hash_bytes(str, strlen(str)) & (state->capacity - 1);
+  while (state->slots[slot] != 0) {
+    int id = state->slots[slot] - 1;
+    if (!strcmp(vec_get(state->strings, id), str)) return id;
+    slot = (slot + 1) & (state->capacity - 1);
+  }
+
+  vec_push(state->strings, strdup(str));
+  state->slots[slot] = state->strings->len;
+  return state->strings->len - 1;
+}
+
+// functions are stored as "Class.name" like in the text form
+static int intern_function(BinaryState *state, char *className, char *name) {
+  size_t len = strlen(className) + strlen(name) + 2;
+  char *full = malloc(len);
+  snprintf(full, len, "%s.%s", className, name);
+  int id = intern(state, full);
+  free(full);
+  return id;
+}
+
+static void binary_func(VMwriter *writer, char *className, char *name, int nLocals) {
+  fputc(OP_FUNCTION, writer->out);
+  put_varint(writer->out, intern_function(writer->sinkData, className, name));
+  put_varint(writer->out, nLocals);
+}
+
+static void binary_push(VMwriter *writer, Segment segment, int index) {
+  fputc(OP_PUSH + segment, writer->out);
+  put_varint(writer->out, index);
+}
+
+static void binary_pop(VMwriter *writer, Segment segment, int index) {
+  fputc(OP_POP + segment, writer->out);
+  put_varint(writer->out, index);
+}
+
+static void binary_arithmetic(VMwriter *writer, Command command) {
+  fputc(OP_ARITHMETIC + command, writer->out);
+}
+
+static void binary_jump(VMwriter *writer, int opcode, char *label) {
+  fputc(opcode, writer->out);
+  put_varint(writer->out, intern(writer->sinkData, label));
+}
+
+static void binary_label(VMwriter *writer, char *label) {
+  binary_jump(writer, OP_LABEL, label);
+}
+
+static void binary_goto(VMwriter *writer, char *label) {
+  binary_jump(writer, OP_GOTO, label);
+}
+
+static void binary_if(VMwriter *writer, char *label) {
+  binary_jump(writer, OP_IF_GOTO, label);
+}
+
+static void binary_call(VMwriter *writer, char *className, char *name, int nArgs) {
+  fputc(OP_CALL, writer->out);
+  put_varint(writer->out, intern_function(writer->sinkData, className, name));
+  put_varint(writer->out, nArgs);
+}
+
+static void binary_return(VMwriter *writer) {
+  fputc(OP_RETURN, writer->out);
+}
+
+// the string table is only complete at the end, so the file is assembled here
+static void binary_finish(VMwriter *writer) {
+  if (writer->out == NULL) return;
+  BinaryState *state = writer->sinkData;
+  fclose(writer->out);
+
+  FILE *out = open_memstream(&writer->data, &writer->len);
+  fwrite("JVMB", 1, 4, out);
+  fputc(VMB_VERSION, out);
+  put_varint(out, state->strings->len);
+  for (int i = 0; i < state->strings->len; i++) {
+    char *str = vec_get(state->strings, i);
+    put_varint(out, strlen(str));
+    fwrite(str, 1, strlen(str), out);
+  }
+  put_varint(out, state->codeLen);
+  fwrite(state->code, 1, state->codeLen, out);
+  fclose(out);
+  writer->out = NULL;
+
+  for (int i = 0; i < state->strings->len; i++) {
+    free(vec_get(state->strings, i));
+  }
+  free(state->strings->data);
+  free(state->strings);
+  free(state->slots);
+  free(state->code);
+  free(state);
+  writer->sinkData = NULL;
+}
+
+static VMwriter *binary_fork(VMwriter *writer) {
+  return new_binary_writer();
+}
+
+static bool decode_vmb(char *data, size_t len, VMwriter *sink, long *nCommands);
+
+// the part has its own string table, so its commands are replayed
+static void binary_append(VMwriter *writer, VMwriter *part) {
+  long nCommands;
+  decode_vmb(part->data, part->len, writer, &nCommands);
+}
+
+static const EmitterOps BINARY_OPS = {
+    binary_func, binary_push, binary_pop, binary_arithmetic, binary_label,
+    binary_goto, binary_if, binary_call, binary_return, binary_finish,
+    binary_fork, binary_append
+};
+
+VMwriter *new_binary_writer(void) {
+  VMwriter *writer = new_vmWriter(&BINARY_OPS);
+  BinaryState *state = malloc(sizeof(BinaryState));
+  state->capacity = 64;
+  state->slots = calloc(state->capacity, sizeof(int));
+  state->strings = new_vec();
+  state->code = NULL;
+  state->codeLen = 0;
+  writer->sinkData = state;
+  writer->out = open_memstream(&state->code, &state->codeLen);
+  return writer;
+}
+
+// binary code that belongs to <fileName>.vmb
+VMwriter *init_binary_vmWriter(char *fileName) {
+  VMwriter *writer = new_binary_writer();
+  writer->outPath = malloc(strlen(fileName) + strlen(".vmb") + 1);
+  strcpy(writer->outPath, fileName);
+  strcat(writer->outPath, ".vmb");
+  return writer;
+}
+
+/*============================ Binary loader ============================ */
+
+typedef struct {
+  unsigned char *pos;
+  unsigned char *end;
+  bool failed;
+} Reader;
+
+static uint32_t get_varint(Reader *r) {
+  uint32_t value = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (r->pos >= r->end) break;
+    unsigned char byte = *r->pos++;
+    value |= (uint32_t) (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) return value;
+  }
+  r->failed = true;
+  return 0;
+}
+
+bool is_vmb(char *data, size_t len) {
+  return len >= 5 && !memcmp(data, "JVMB", 4);
+}
+
+// "Class.name" split for the writer interface
+typedef struct {
+  char *full;
+  char *className;
+  char *name;
+} VmbString;
+
+static VmbString *read_strings(Reader *r, uint32_t *nStrings) {
+  *nStrings = get_varint(r);
+  if (r->failed || *nStrings > (size_t) (r->end - r->pos)) {
+    r->failed = true;
+    return NULL;
+  }
+
+  VmbString *strings = calloc(*nStrings > 0 ? *nStrings : 1, sizeof(VmbString));
+  for (uint32_t i = 0; i < *nStrings && !r->failed; i++) {
+    uint32_t len = get_varint(r);
+    if (r->failed || len > (size_t) (r->end - r->pos)) {
+      r->failed = true;
+      break;
+    }
+
+    strings[i].full = strndup((char *) r->pos, len);
+    r->pos += len;
+    char *dot = strchr(strings[i].full, '.');
+    if (dot != NULL) {
+      strings[i].className = strndup(strings[i].full, dot - strings[i].full);
+      strings[i].name = dot + 1;
+    }
+  }
+  return strings;
+}
+
+static VmbString *get_string(Reader *r, VmbString *strings, uint32_t nStrings, bool function) {
+  uint32_t id = get_varint(r);
+  if (id >= nStrings || (function && strings[id].className == NULL)) {
+    r->failed = true;
+    return NULL;
+  }
+  return &strings[id];
+}
+
+// calls the sink directly, leaving its command count alone
+static bool decode_vmb(char *data, size_t len, VMwriter *sink, long *nCommands) {
+  *nCommands = 0;
+  if (!is_vmb(data, len) || data[4] != VMB_VERSION) return false;
+
+  Reader r = {(unsigned char *) data + 5, (unsigned char *) data + len, false};
+  uint32_t nStrings;
+  VmbString *strings = read_strings(&r, &nStrings);
+  uint32_t codeLen = get_varint(&r);
+  if (!r.failed && codeLen != (size_t) (r.end - r.pos)) r.failed = true;
+
+  const EmitterOps *ops = sink->ops;
+  while (!r.failed && r.pos < r.end) {
+    int op = *r.pos++;
+    VmbString *str;
+
+    if (op < OP_POP) {
+      ops->push(sink, op - OP_PUSH, get_varint(&r));
+    } else if (op < OP_ARITHMETIC) {
+      ops->pop(sink, op - OP_POP, get_varint(&r));
+    } else if (op <= OP_ARITHMETIC + NOT) {
+      ops->arithmetic(sink, op - OP_ARITHMETIC);
+    } else if (op == OP_LABEL || op == OP_GOTO || op == OP_IF_GOTO) {
+      if ((str = get_string(&r, strings, nStrings, false)) == NULL) break;
+      if (op == OP_LABEL) ops->label(sink, str->full);
+      if (op == OP_GOTO) ops->gotoLabel(sink, str->full);
+      if (op == OP_IF_GOTO) ops->ifGoto(sink, str->full);
+    } else if (op == OP_FUNCTION || op == OP_CALL) {
+      if ((str = get_string(&r, strings, nStrings, true)) == NULL) break;
+      int n = get_varint(&r);
+      if (op == OP_FUNCTION) {
+        ops->func(sink, str->className, str->name, n);
+      } else {
+        ops->call(sink, str->className, str->name, n);
+      }
+    } else if (op == OP_RETURN) {
+      ops->ret(sink);
+    } else {
+      r.failed = true;
+    }
+    (*nCommands)++;
+  }
+
+  for (uint32_t i = 0; strings != NULL && i < nStrings; i++) {
+    free(strings[i].full);
+    free(strings[i].className);
+  }
+  free(strings);
+  return !r.failed;
+}
+
+bool load_vmb(char *data, size_t len, VMwriter *sink) {
+  long nCommands;
+  bool ok = decode_vmb(data, len, sink, &nCommands);
+  sink->nCommands += nCommands;
+  return ok;
+}
+
+/*============================ Text loader ============================ */
+
+static int find_name(const char **names, int n, char *word) {
+  for (int i = 0; i < n; i++) {
+    if (!strcmp(names[i], word)) return i;
+  }
+  return -1;
+}
+
+static bool parse_number(char *word, int *value) {
+  if (word == NULL || !isdigit((unsigned char) *word)) return false;
+  char *end;
+  long number = strtol(word, &end, 10);
+  *value = (int) number;
+  return *end == '\0' && number <= INT32_MAX;
+}
+
+static bool load_line(VMwriter *sink, char *line) {
+  char *save;
+  char *cmd = strtok_r(line, " \t\r", &save);
+  if (cmd == NULL) return true;
+  char *arg1 = strtok_r(NULL, " \t\r", &save);
+  char *arg2 = strtok_r(NULL, " \t\r", &save);
+  int n;
+
+  int command = find_name(COMMAND_STRING, NOT + 1, cmd);
+  if (command != -1) {
+    write_arithmetic(sink, command);
+    return arg1 == NULL;
+  }
+
+  if (!strcmp(cmd, "push") || !strcmp(cmd, "pop")) {
+    int segment = arg1 != NULL ? find_name(SEGMENT_STRING, SEGMENT_TEMP + 1, arg1) : -1;
+    if (segment == -1 || !parse_number(arg2, &n)) return false;
+    if (cmd[1] == 'u') {
+      write_push_i(sink, segment, n);
+    } else {
+      write_pop_i(sink, segment, n);
+    }
+    return true;
+  }
+
+  if (!strcmp(cmd, "label") || !strcmp(cmd, "goto") || !strcmp(cmd, "if-goto")) {
+    if (arg1 == NULL || arg2 != NULL) return false;
+    if (cmd[0] == 'l') write_label(sink, arg1);
+    if (cmd[0] == 'g') write_goto(sink, arg1);
+    if (cmd[0] == 'i') write_if(sink, arg1);
+    return true;
+  }
+
+  if (!strcmp(cmd, "function") || !strcmp(cmd, "call")) {
+    char *dot = arg1 != NULL ? strchr(arg1, '.') : NULL;
+    if (dot == NULL || !parse_number(arg2, &n)) return false;
+    *dot = '\0';
+    if (cmd[0] == 'f') {
+      write_func(sink, arg1, dot + 1, n);
+    } else {
+      write_call(sink, arg1, dot + 1, n);
+    }
+    return true;
+  }
+
+  if (!strcmp(cmd, "return")) {
+    write_return(sink);
+    return arg1 == NULL;
+  }
+  return false;
+}
+
+// comments and blank lines are skipped
+bool load_vm_text(char *data, size_t len, VMwriter *sink) {
+  char *text = strndup(data, len);
+  int lineNumber = 0;
+  bool ok = true;
+
+  char *save;
+  for (char *line = strtok_r(text, "\n", &save); line != NULL; line = strtok_r(NULL, "\n", &save)) {
+    lineNumber++;
+    char *comment = strstr(line, "//");
+    if (comment != NULL) *comment = '\0';
+
+    if (!load_line(sink, line)) {
+      xprintf("line %i: not a VM command\n", lineNumber);
+      ok = false;
+      break;
+    }
+  }
+
+  free(text);
+  return ok;
+}
+
+/*============================ Converter ============================ */
+
+// the direction follows the input: .vmb becomes text and text becomes .vmb
+bool convert_vm_file(char *inPath, char *outPath) {
+  size_t len;
+  char *data = read_whole_file(inPath, &len);
+  if (data == NULL) {
+    xprintf("could not read %s\n", inPath);
+    return false;
+  }
+
+  VMwriter *writer;
+  bool ok;
+  if (is_vmb(data, len)) {
+    writer = new_memory_writer();
+    ok = load_vmb(data, len, writer);
+  } else {
+    writer = new_binary_writer();
+    ok = load_vm_text(data, len, writer);
+  }
+  finish_vmWriter(writer);
+  free(data);
+
+  if (!ok) {
+    xprintf("%s is not a valid VM program\n", inPath);
+    return false;
+  }
+
+  writer->outPath = outPath;
+  close_vmWriter(writer);
+  return true;
+}
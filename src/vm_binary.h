@@ -0,0 +1,24 @@
+
+#ifndef COMPILER_VM_BINARY_H
+#define COMPILER_VM_BINARY_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "vm_writer.h"
+
+// Binary form of the VM language (.vmb). Every command is a one-byte opcode,
+// push and pop carry the segment in the opcode, and indices and counts are
+// varints. Function and label names are stored once in a string table in
+// front of the code and referred to by their number:
+//   "JVMB" version nStrings (len bytes)* codeLen code
+VMwriter *new_binary_writer(void);
+VMwriter *init_binary_vmWriter(char *fileName);
+
+// the loaders replay a program into any writer, e.g. a text writer to convert
+// .vmb into .vm or a binary writer for the opposite direction
+bool is_vmb(char *data, size_t len);
+bool load_vmb(char *data, size_t len, VMwriter *sink);
+bool load_vm_text(char *data, size_t len, VMwriter *sink);
+bool convert_vm_file(char *inPath, char *outPath);
+
+#endif //COMPILER_VM_BINARY_H
@@ -0,0 +1,338 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include "vm_ir.h"
+#include "util.h"
+
+IrFunction *new_ir_function(void) {
+  IrFunction *ir = malloc(sizeof(IrFunction));
+  ir->capacity = 64;
+  ir->code = malloc(sizeof(IrInstr) * ir->capacity);
+  ir->lines = malloc(sizeof(int) * ir->capacity);
+  ir->len = 0;
+  ir->curLine = 0;
+  ir->namesCapacity = 16;
+  ir->names = malloc(sizeof(IrName) * ir->namesCapacity);
+  ir->nNames = 0;
+  ir->nSlots = 32;
+  ir->slots = calloc(ir->nSlots, sizeof(int));
+  return ir;
+}
+
+void free_ir_function(IrFunction *ir) {
+  for (int i = 0; i < ir->nNames; i++) {
+    free(ir->names[i].className);
+    free(ir->names[i].name);
+  }
+  free(ir->names);
+  free(ir->slots);
+  free(ir->code);
+  free(ir->lines);
+  free(ir);
+}
+
+/*============================ Names ============================ */
+
+static uint64_t hash_name(char *className, char *name) {
+  uint64_t hash = hash_bytes(name, strlen(name));
+  return className != NULL ? hash ^ (hash_bytes(className, strlen(className)) * 31) : hash;
+}
+
+static bool same_name(IrName *irName, char *className, char *name) {
+  if ((irName->className == NULL) != (className == NULL)) return false;
+  if (className != NULL && strcmp(irName->className, className) != 0) return false;
+  return !strcmp(irName->name, name);
+}
+
+static void grow_slots(IrFunction *ir) {
+  free(ir->slots);
+  ir->nSlots *= 2;
+  ir->slots = calloc(ir->nSlots, sizeof(int));
+
+  for (int i = 0; i < ir->nNames; i++) {
+    int slot = hash_name(ir->names[i].className, ir->names[i].name) & (ir->nSlots - 1);
+    while (ir->slots[slot] != 0) slot = (slot + 1) & (ir->nSlots - 1);
+    ir->slots[slot] = i + 1;
+  }
+}
+
+// the id of a label (className NULL) or a function; names are copied
+int ir_intern(IrFunction *ir, char *className, char *name) {
+  if ((ir->nNames + 1) * 2 > ir->nSlots) {
+    grow_slots(ir);
+  }
+
+  int slot = hash_name(className, name) & (ir->nSlots - 1);
+  while (ir->slots[slot] != 0) {
+    int id = ir->slots[slot] - 1;
+    if (same_name(&ir->names[id], className, name)) return id;
+    slot = (slot + 1) & (ir->nSlots - 1);
+  }
+
+  if (ir->nNames == ir->namesCapacity) {
+    ir->namesCapacity *= 2;
+    ir->names = realloc(ir->names, sizeof(IrName) * ir->namesCapacity);
+  }
+  ir->names[ir->nNames].className = className != NULL ? strdup(className) : NULL;
+  ir->names[ir->nNames].name = strdup(name);
+  ir->slots[slot] = ++ir->nNames;
+  return ir->nNames - 1;
+}
+
+/*============================ Code ============================ */
+
+IrInstr ir_instr(IrOp op, int arg, int operand, int name) {
+  IrInstr instr = {op, arg, operand, name};
+  return instr;
+}
+
+static void reserve(IrFunction *ir, int len) {
+  if (len <= ir->capacity) return;
+  while (ir->capacity < len) ir->capacity *= 2;
+  ir->code = realloc(ir->code, sizeof(IrInstr) * ir->capacity);
+  ir->lines = realloc(ir->lines, sizeof(int) * ir->capacity);
+}
+
+void ir_append(IrFunction *ir, IrInstr instr) {
+  reserve(ir, ir->len + 1);
+  ir->lines[ir->len] = ir->curLine;
+  ir->code[ir->len++] = instr;
+}
+
+void ir_insert(IrFunction *ir, int index, IrInstr instr) {
+  ir_replace(ir, index, 0, &instr, 1);
+}
+
+void ir_remove(IrFunction *ir, int index, int count) {
+  ir_replace(ir, index, count, NULL, 0);
+}
+
+// replaces count commands at index with len new ones, which take the line
+// of the first command they replace
+void ir_replace(IrFunction *ir, int index, int count, IrInstr *code, int len) {
+  int line = index < ir->len ? ir->lines[index] : ir->curLine;
+  reserve(ir, ir->len - count + len);
+
+  int tail = ir->len - index - count;
+  memmove(&ir->code[index + len], &ir->code[index + count], sizeof(IrInstr) * tail);
+  memmove(&ir->lines[index + len], &ir->lines[index + count], sizeof(int) * tail);
+  for (int i = 0; i < len; i++) {
+    ir->code[index + i] = code[i];
+    ir->lines[index + i] = line;
+  }
+  ir->len += len - count;
+}
+
+/*============================ Analysis ============================ */
+
+bool ir_is_call(IrFunction *ir, IrInstr *instr, char *className, char *name) {
+  if (instr->op != IR_CALL) return false;
+  IrName *callee = &ir->names[instr->name];
+  return !strcmp(callee->className, className) && !strcmp(callee->name, name);
+}
+
+// how many values the command takes from and puts on the stack
+void ir_stack_effect(IrInstr *instr, int *pops, int *pushes) {
+  *pops = 0;
+  *pushes = 0;
+  switch (instr->op) {
+    case IR_PUSH:
+      *pushes = 1;
+      break;
+    case IR_POP: case IR_IF_GOTO: case IR_RETURN:
+      *pops = 1;
+      break;
+    case IR_ARITHMETIC:
+      *pops = instr->arg == NEG || instr->arg == NOT ? 1 : 2;
+      *pushes = 1;
+      break;
+    case IR_CALL:
+      *pops = instr->operand;
+      *pushes = 1;
+      break;
+    default:
+      break;
+  }
+}
+
+// the first command of the code that computes the value on top of the
+// stack at end, or -1 if that code is not a straight sequence
+int ir_operand_start(IrFunction *ir, int end) {
+  int need = 1;
+  for (int i = end - 1; i > 0; i--) {
+    IrInstr *instr = &ir->code[i];
+    if (instr->op != IR_PUSH && instr->op != IR_POP && instr->op != IR_ARITHMETIC && instr->op != IR_CALL) {
+      return -1;
+    }
+
+    int pops, pushes;
+    ir_stack_effect(instr, &pops, &pushes);
+    need += pops - pushes;
+    if (need == 0) return i;
+    if (need < 0) return -1;
+  }
+  return -1;
+}
+
+// bit i is set if temp i is never used by the subroutine
+int ir_free_temps(IrFunction *ir) {
+  int free = 0xff;
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    if ((instr->op == IR_PUSH || instr->op == IR_POP) && instr->arg == SEGMENT_TEMP) {
+      free &= ~(1 << instr->operand);
+    }
+  }
+  return free;
+}
+
+long ir_cost(IrFunction *ir, IrInstr *instr) {
+  switch (instr->op) {
+    case IR_PUSH:
+      return COST_PUSH;
+    case IR_POP:
+      return COST_POP;
+    case IR_ARITHMETIC:
+      return instr->arg == EQ || instr->arg == GT || instr->arg == LT ? COST_COMPARE : COST_ARITHMETIC;
+    case IR_CALL:
+      if (ir_is_call(ir, instr, "Math", "multiply")) return COST_MULTIPLY;
+      if (ir_is_call(ir, instr, "Math", "divide")) return COST_DIVIDE;
+      return COST_CALL;
+    default:
+      return 0;
+  }
+}
+
+long ir_cost_of(IrFunction *ir, IrInstr *code, int len) {
+  long total = 0;
+  for (int i = 0; i < len; i++) {
+    total += ir_cost(ir, &code[i]);
+  }
+  return total;
+}
+
+/*============================ IR sink ============================ */
+
+// operands are 16 bits like the words of the Hack machine
+static int16_t operand(int value) {
+  if (value < INT16_MIN || value > INT16_MAX) {
+    xprintf("%i does not fit into a 16-bit word\n", value);
+    abort_compilation();
+  }
+  return (int16_t) value;
+}
+
+static void add(VMwriter *writer, IrOp op, int arg, int value, int name) {
+  IrInstr instr = {op, arg, operand(value), name};
+  ir_append(writer->sinkData, instr);
+}
+
+static void ir_func(VMwriter *writer, char *className, char *name, int nLocals) {
+  add(writer, IR_FUNCTION, 0, nLocals, ir_intern(writer->sinkData, className, name));
+}
+
+static void ir_push(VMwriter *writer, Segment segment, int index) {
+  add(writer, IR_PUSH, segment, index, -1);
+}
+
+static void ir_pop(VMwriter *writer, Segment segment, int index) {
+  add(writer, IR_POP, segment, index, -1);
+}
+
+static void ir_arithmetic(VMwriter *writer, Command command) {
+  add(writer, IR_ARITHMETIC, command, 0, -1);
+}
+
+static void ir_label(VMwriter *writer, char *label) {
+  add(writer, IR_LABEL, 0, 0, ir_intern(writer->sinkData, NULL, label));
+}
+
+static void ir_goto(VMwriter *writer, char *label) {
+  add(writer, IR_GOTO, 0, 0, ir_intern(writer->sinkData, NULL, label));
+}
+
+static void ir_if(VMwriter *writer, char *label) {
+  add(writer, IR_IF_GOTO, 0, 0, ir_intern(writer->sinkData, NULL, label));
+}
+
+static void ir_call(VMwriter *writer, char *className, char *name, int nArgs) {
+  add(writer, IR_CALL, 0, nArgs, ir_intern(writer->sinkData, className, name));
+}
+
+static void ir_return(VMwriter *writer) {
+  add(writer, IR_RETURN, 0, 0, -1);
+}
+
+static void ir_finish(VMwriter *writer) {}
+
+static VMwriter *ir_fork(VMwriter *writer) {
+  return new_ir_writer(new_ir_function());
+}
+
+// append_vmWriter counts the commands of the part itself
+static void ir_append_part(VMwriter *writer, VMwriter *part) {
+  print_ir(part->sinkData, writer);
+  writer->nCommands -= part->nCommands;
+}
+
+static const EmitterOps IR_OPS = {
+    ir_func, ir_push, ir_pop, ir_arithmetic, ir_label,
+    ir_goto, ir_if, ir_call, ir_return, ir_finish,
+    ir_fork, ir_append_part
+};
+
+// a writer that records into ir instead of producing output
+VMwriter *new_ir_writer(IrFunction *ir) {
+  VMwriter *writer = new_vmWriter(&IR_OPS);
+  writer->sinkData = ir;
+  return writer;
+}
+
+// the line of the statement the following commands belong to
+void ir_set_line(VMwriter *writer, int line) {
+  if (writer->ops == &IR_OPS) {
+    ((IrFunction *) writer->sinkData)->curLine = line;
+  }
+}
+
+/*============================ Printer ============================ */
+
+void print_ir(IrFunction *ir, VMwriter *writer) {
+  for (int i = 0; i < ir->len; i++) {
+    IrInstr *instr = &ir->code[i];
+    IrName *name = instr->name >= 0 ? &ir->names[instr->name] : NULL;
+
+    switch (instr->op) {
+      case IR_FUNCTION:
+        write_func(writer, name->className, name->name, instr->operand);
+        break;
+      case IR_PUSH:
+        write_push_i(writer, instr->arg, instr->operand);
+        break;
+      case IR_POP:
+        write_pop_i(writer, instr->arg, instr->operand);
+        break;
+      case IR_ARITHMETIC:
+        write_arithmetic(writer, instr->arg);
+        break;
+      case IR_LABEL:
+        write_label(writer, name->name);
+        break;
+      case IR_GOTO:
+        write_goto(writer, name->name);
+        break;
+      case IR_IF_GOTO:
+        write_if(writer, name->name);
+        break;
+      case IR_CALL:
+        write_call(writer, name->className, name->name, instr->operand);
+        break;
+      case IR_RETURN:
+        write_return(writer);
+        break;
+      default:
+        xprintf("%i is not an IR operation\n", instr->op);
+        abort_compilation();
+    }
+  }
+}
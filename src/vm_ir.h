@@ -0,0 +1,88 @@
+
+#ifndef COMPILER_VM_IR_H
+#define COMPILER_VM_IR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "vm_writer.h"
+
+typedef enum {
+  IR_FUNCTION,
+  IR_PUSH,
+  IR_POP,
+  IR_ARITHMETIC,
+  IR_LABEL,
+  IR_GOTO,
+  IR_IF_GOTO,
+  IR_CALL,
+  IR_RETURN
+} IrOp;
+
+// one VM command in 8 bytes
+typedef struct {
+  uint8_t op;
+  // the Segment of push and pop, the Command of arithmetic
+  uint8_t arg;
+  // index, nLocals or nArgs
+  int16_t operand;
+  // interned label or function, -1 if the command has none
+  int32_t name;
+} IrInstr;
+
+// labels have no class
+typedef struct {
+  char *className;
+  char *name;
+} IrName;
+
+// The commands of one subroutine. The engine generates every subroutine into
+// an IrFunction through the write_* functions and prints it afterwards, so
+// passes can inspect and rewrite the code before any output is produced. The
+// function command comes first; passes that add locals raise its operand.
+typedef struct {
+  IrInstr *code;
+  // source line of each command
+  int *lines;
+  int len;
+  int capacity;
+  int curLine;
+  IrName *names;
+  int nNames;
+  int namesCapacity;
+  // open addressing over names, each slot holds a name id + 1
+  int *slots;
+  int nSlots;
+} IrFunction;
+
+// Math.multiply and Math.divide are software loops over the 16 bits of a
+// word, so a product or quotient is far dearer than any other command. Costs
+// are rough counts of Hack instructions.
+#define COST_PUSH 7
+#define COST_POP 8
+#define COST_ARITHMETIC 6
+#define COST_COMPARE 14
+#define COST_CALL 60
+#define COST_MULTIPLY 1000
+#define COST_DIVIDE 2000
+
+IrFunction *new_ir_function(void);
+void free_ir_function(IrFunction *ir);
+int ir_intern(IrFunction *ir, char *className, char *name);
+IrInstr ir_instr(IrOp op, int arg, int operand, int name);
+void ir_append(IrFunction *ir, IrInstr instr);
+void ir_insert(IrFunction *ir, int index, IrInstr instr);
+void ir_remove(IrFunction *ir, int index, int count);
+void ir_replace(IrFunction *ir, int index, int count, IrInstr *code, int len);
+
+bool ir_is_call(IrFunction *ir, IrInstr *instr, char *className, char *name);
+void ir_stack_effect(IrInstr *instr, int *pops, int *pushes);
+int ir_operand_start(IrFunction *ir, int end);
+int ir_free_temps(IrFunction *ir);
+long ir_cost(IrFunction *ir, IrInstr *instr);
+long ir_cost_of(IrFunction *ir, IrInstr *code, int len);
+
+VMwriter *new_ir_writer(IrFunction *ir);
+void ir_set_line(VMwriter *writer, int line);
+void print_ir(IrFunction *ir, VMwriter *writer);
+
+#endif //COMPILER_VM_IR_H
@@ -1,5 +1,4 @@
 
-
 #include <stdio.h>
 #include <zconf.h>
 #include <string.h>
@@ -15,6 +14,7 @@ const char *COMMAND_STRING[] = {
     "add", "sub", "neg", "eq", "gt", "lt", "and", "or", "not"
 };
 
+/*============================ Text sink ============================ */
 
 static void emit(VMwriter *writer, char *fmt, int n, ...) {
   fprintf(writer->out, "%*s", writer->indentation, "");
@@ -30,65 +30,218 @@ static void emit(VMwriter *writer, char *fmt, int n, ...) {
   va_end(argp);
 }
 
-VMwriter *init_vmWriter(char *fileName) {
+static void text_push(VMwriter *writer, Segment segment, int index) {
+  char *indexStr = number_to_string(index);
+  emit(writer, "%s ", 3, "push", SEGMENT_STRING[segment], indexStr);
+  free(indexStr);
+}
+
+static void text_pop(VMwriter *writer, Segment segment, int index) {
+  char *indexStr = number_to_string(index);
+  emit(writer, "%s ", 3, "pop", SEGMENT_STRING[segment], indexStr);
+  free(indexStr);
+}
+
+static void text_arithmetic(VMwriter *writer, Command command) {
+  emit(writer, "%s", 1, COMMAND_STRING[command]);
+}
+
+static void text_label(VMwriter *writer, char *label) {
+  emit(writer, "%s ", 2, "label", label);
+}
+
+static void text_goto(VMwriter *writer, char *label) {
+  emit(writer, "%s ", 2, "goto", label);
+}
+
+static void text_if(VMwriter *writer, char *label) {
+  emit(writer, "%s ", 2, "if-goto", label);
+}
+
+static void text_call(VMwriter *writer, char *className, char *label, int nArgs) {
+  char *nArgsStr = number_to_string(nArgs);
+  emit(writer, "%s", 6, "call ", className, ".", label, " ", nArgsStr);
+  free(nArgsStr);
+}
+
+static void text_func(VMwriter *writer, char *className, char *name, int nLocals) {
+  char *nLocalsStr = number_to_string(nLocals);
+  emit(writer, "%s", 6, "function ", className, ".", name, " ", nLocalsStr);
+  free(nLocalsStr);
+}
+
+static void text_return(VMwriter *writer) {
+  emit(writer, "%s", 1, "return");
+}
+
+// after this call writer->data and writer->len hold the generated code
+static void text_finish(VMwriter *writer) {
+  if (writer->out != NULL) {
+    fclose(writer->out);
+    writer->out = NULL;
+  }
+}
+
+static VMwriter *text_fork(VMwriter *writer) {
+  return new_memory_writer();
+}
+
+static void text_append(VMwriter *writer, VMwriter *part) {
+  fwrite(part->data, 1, part->len, writer->out);
+}
+
+static const EmitterOps TEXT_OPS = {
+    text_func, text_push, text_pop, text_arithmetic, text_label,
+    text_goto, text_if, text_call, text_return, text_finish,
+    text_fork, text_append
+};
+
+/*============================ Null sink ============================ */
+
+// only counts the commands, which keeps benchmarks free of any output cost
+static void null_func(VMwriter *writer, char *className, char *name, int nLocals) {}
+static void null_push_pop(VMwriter *writer, Segment segment, int index) {}
+static void null_arithmetic(VMwriter *writer, Command command) {}
+static void null_label(VMwriter *writer, char *label) {}
+static void null_call(VMwriter *writer, char *className, char *name, int nArgs) {}
+static void null_return(VMwriter *writer) {}
+static void null_finish(VMwriter *writer) {}
+static VMwriter *null_fork(VMwriter *writer) { return new_null_writer(); }
+static void null_append(VMwriter *writer, VMwriter *part) {}
+
+static const EmitterOps NULL_OPS = {
+    null_func, null_push_pop, null_push_pop, null_arithmetic, null_label,
+    null_label, null_label, null_call, null_return, null_finish,
+    null_fork, null_append
+};
+
+/*============================ Writers ============================ */
+
+// a writer for any sink; the sink sets up out and sinkData itself
+VMwriter *new_vmWriter(const EmitterOps *ops) {
   VMwriter *writer = malloc(sizeof(VMwriter));
-  char outF[strlen(fileName) + strlen(".vm") + 1];
-  strcpy(outF, fileName);
-  strcat(outF, ".vm");
-  writer->out = fopen(outF, "w");
+  writer->ops = ops;
+  writer->out = NULL;
   writer->indentation = 0;
+  writer->className = NULL;
+  writer->outPath = NULL;
+  writer->data = NULL;
+  writer->len = 0;
+  writer->nCommands = 0;
+  writer->sinkData = NULL;
+  return writer;
+}
+
+// text that stays in memory; compare writer->data after finish_vmWriter
+VMwriter *new_memory_writer(void) {
+  VMwriter *writer = new_vmWriter(&TEXT_OPS);
+  writer->out = open_memstream(&writer->data, &writer->len);
+  return writer;
+}
+
+// text that belongs to <fileName>.vm
+VMwriter *init_vmWriter(char *fileName) {
+  VMwriter *writer = new_memory_writer();
+  writer->outPath = malloc(strlen(fileName) + strlen(".vm") + 1);
+  strcpy(writer->outPath, fileName);
+  strcat(writer->outPath, ".vm");
   return writer;
 }
 
+VMwriter *new_null_writer(void) {
+  return new_vmWriter(&NULL_OPS);
+}
+
+// a writer of the same kind whose output is later added with append_vmWriter;
+// used to generate the subroutines of one class on several threads
+VMwriter *fork_vmWriter(VMwriter *writer) {
+  return writer->ops->fork(writer);
+}
+
+void append_vmWriter(VMwriter *writer, VMwriter *part) {
+  finish_vmWriter(part);
+  writer->ops->append(writer, part);
+  writer->nCommands += part->nCommands;
+}
+
+// output that was produced earlier by a writer of the same kind
+void append_raw_vmWriter(VMwriter *writer, char *data, size_t len, long nCommands) {
+  VMwriter part = *writer;
+  part.out = NULL;
+  part.data = data;
+  part.len = len;
+  part.nCommands = nCommands;
+  writer->ops->append(writer, &part);
+  writer->nCommands += nCommands;
+}
+
+void finish_vmWriter(VMwriter *writer) {
+  writer->ops->finish(writer);
+}
+
+void close_vmWriter(VMwriter *writer) {
+  finish_vmWriter(writer);
+  if (writer->outPath == NULL) return;
+
+  FILE *out = fopen(writer->outPath, "w");
+  if (out == NULL) {
+    xprintf("could not open %s\n", writer->outPath);
+    exit(EXIT_FAILURE);
+  }
+  fwrite(writer->data, 1, writer->len, out);
+  fclose(out);
+}
+
 void write_push_i(VMwriter *writer, Segment segment, int index) {
-  char *indexStr = number_to_string(index);
-  emit(writer, "%s ", 3, "push", SEGMENT_STRING[segment], indexStr);
-  free(indexStr);
+  writer->nCommands++;
+  writer->ops->push(writer, segment, index);
 }
 
 void write_push(VMwriter *writer, Segment segment, char *index) {
-  emit(writer, "%s ", 3, "push", SEGMENT_STRING[segment], index);
+  write_push_i(writer, segment, atoi(index));
 }
 
 void write_pop_i(VMwriter *writer, Segment segment, int index) {
-  char *indexStr = number_to_string(index);
-  emit(writer, "%s ", 3, "pop", SEGMENT_STRING[segment], indexStr);
-  free(indexStr);
+  writer->nCommands++;
+  writer->ops->pop(writer, segment, index);
 }
 
 // UNUSED
 void write_pop(VMwriter *writer, Segment segment, char *index) {
-  emit(writer, "%s ", 3, "pop", SEGMENT_STRING[segment], index);
+  write_pop_i(writer, segment, atoi(index));
 }
 
 void write_arithmetic(VMwriter *writer, Command command) {
-  emit(writer, "%s", 1, COMMAND_STRING[command]);
+  writer->nCommands++;
+  writer->ops->arithmetic(writer, command);
 }
 
 void write_label(VMwriter *writer, char *label) {
-  emit(writer, "%s ", 2, "label", label);
+  writer->nCommands++;
+  writer->ops->label(writer, label);
 }
 
 void write_goto(VMwriter *writer, char *label) {
-  emit(writer, "%s ", 2, "goto", label);
+  writer->nCommands++;
+  writer->ops->gotoLabel(writer, label);
 }
 
 void write_if(VMwriter *writer, char *label) {
-  emit(writer, "%s ", 2, "if-goto", label);
+  writer->nCommands++;
+  writer->ops->ifGoto(writer, label);
 }
 
 void write_call(VMwriter *writer, char *className, char *label, int nArgs) {
-  char *nArgsStr = number_to_string(nArgs);
-  emit(writer, "%s", 6, "call ", className, ".", label, " ", nArgsStr);
-  free(nArgsStr);
+  writer->nCommands++;
+  writer->ops->call(writer, className, label, nArgs);
 }
 
 void write_func(VMwriter *writer, char *className, char *name, int nLocals) {
-  char *nLocalsStr = number_to_string(nLocals);
-  emit(writer, "%s", 6, "function ", className, ".", name, " ", nLocalsStr);
-  free(nLocalsStr);
+  writer->nCommands++;
+  writer->ops->func(writer, className, name, nLocals);
 }
 
 void write_return(VMwriter *writer) {
-  emit(writer, "%s", 1, "return");
+  writer->nCommands++;
+  writer->ops->ret(writer);
 }
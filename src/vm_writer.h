@@ -3,12 +3,7 @@
 #ifndef COMPILER_VM_WRITER_H
 #define COMPILER_VM_WRITER_H
 
-// contains info about writer
-typedef struct {
-  FILE *out;
-  int indentation;
-  char *className;
-} VMwriter;
+#include <stdio.h>
 
 typedef enum {
   SEGMENT_CONST,
@@ -33,8 +28,50 @@ typedef enum {
   NOT
 } Command;
 
+extern const char *SEGMENT_STRING[];
+extern const char *COMMAND_STRING[];
+
+typedef struct VMwriter VMwriter;
+
+// the table of functions every output sink implements; write_* dispatch here
+typedef struct {
+  void (*func)(VMwriter *writer, char *className, char *name, int nLocals);
+  void (*push)(VMwriter *writer, Segment segment, int index);
+  void (*pop)(VMwriter *writer, Segment segment, int index);
+  void (*arithmetic)(VMwriter *writer, Command command);
+  void (*label)(VMwriter *writer, char *label);
+  void (*gotoLabel)(VMwriter *writer, char *label);
+  void (*ifGoto)(VMwriter *writer, char *label);
+  void (*call)(VMwriter *writer, char *className, char *name, int nArgs);
+  void (*ret)(VMwriter *writer);
+  void (*finish)(VMwriter *writer);
+  VMwriter *(*fork)(VMwriter *writer);
+  void (*append)(VMwriter *writer, VMwriter *part);
+} EmitterOps;
+
+// contains info about writer
+// text sinks collect their output in memory; the file sink is written out in one go
+struct VMwriter {
+  const EmitterOps *ops;
+  FILE *out;
+  int indentation;
+  char *className;
+  char *outPath;
+  char *data;
+  size_t len;
+  long nCommands;
+  // private state of sinks that need more than the output stream
+  void *sinkData;
+};
 
+VMwriter *new_vmWriter(const EmitterOps *ops);
 VMwriter *init_vmWriter(char *fileName);
+VMwriter *new_memory_writer(void);
+VMwriter *new_null_writer(void);
+VMwriter *fork_vmWriter(VMwriter *writer);
+void append_vmWriter(VMwriter *writer, VMwriter *part);
+void append_raw_vmWriter(VMwriter *writer, char *data, size_t len, long nCommands);
+void finish_vmWriter(VMwriter *writer);
 void close_vmWriter(VMwriter *writer);
 void write_func(VMwriter *writer, char *className, char *name, int nLocals);
 void write_return(VMwriter *writer);
@@ -0,0 +1,205 @@
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/inotify.h>
+#include "watch.h"
+#include "build.h"
+#include "io_batch.h"
+
+#define EVENT_BUFFER_SIZE 65536
+
+static double elapsed_ms(struct timespec *start) {
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+typedef struct {
+  // path -> CompiledClass
+  Map *compiled;
+  // path -> ClassHeader
+  Map *headers;
+  SignatureIndex *signatures;
+} WatchState;
+
+static void rebuild_signatures(WatchState *state) {
+  Vector *vals = state->headers->vals;
+  ClassHeader **classes = malloc(sizeof(ClassHeader *) * (vals->len > 0 ? vals->len : 1));
+  int n = 0;
+  for (int i = 0; i < vals->len; i++) {
+    if (vec_get(vals, i) != NULL) classes[n++] = vec_get(vals, i);
+  }
+
+  if (state->signatures != NULL) {
+    free(state->signatures->image);
+    free(state->signatures);
+  }
+  state->signatures = new_signature_index(classes, n);
+  free(classes);
+}
+
+// the index is only rebuilt when a save changed the headers of the class;
+// returns whether it was
+static bool update_header(WatchState *state, char *path, char *source, size_t len) {
+  ClassHeader *header = source != NULL ? scan_class_header(source, len) : NULL;
+  ClassHeader *old = map_get(state->headers, path);
+  map_set(state->headers, path, header);
+
+  if (state->signatures != NULL && same_class_header(old, header)) return false;
+  rebuild_signatures(state);
+  return true;
+}
+
+static void recompile(WatchState *state, char *path, Options *options, bool force);
+
+// calls into a class are checked and generated against its headers, so when
+// they change every other class is compiled again; the hash of the index is
+// part of the key of each cached subroutine, so none of them is reused
+static void recompile_others(WatchState *state, char *path, Options *options) {
+  Vector *paths = state->compiled->keys;
+  for (int i = 0; i < paths->len; i++) {
+    char *other = vec_get(paths, i);
+    if (strcmp(other, path) != 0 && map_get(state->compiled, other) != NULL) {
+      recompile(state, other, options, true);
+    }
+  }
+}
+
+// compiles a single class and rewrites its vm file; classes whose source did
+// not change (e.g. a save without edits) are served from the cache unless
+// forced
+static void recompile(WatchState *state, char *path, Options *options, bool force) {
+  Map *cache = state->compiled;
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  size_t len;
+  char *source = read_whole_file(path, &len);
+  if (source == NULL) {
+    xprintf("could not read %s\n", path);
+    return;
+  }
+
+  CompiledClass *cached = map_get(cache, path);
+  if (!force && cached != NULL && cached->sourceHash == hash_bytes(source, len)) {
+    free(source);
+    return;
+  }
+
+  bool headerChanged = update_header(state, path, source, len);
+
+  jmp_buf trap;
+  if (setjmp(trap)) {
+    set_error_trap(NULL);
+    xprintf("%s: compilation failed, the previous output is kept\n", path);
+  } else {
+    set_error_trap(&trap);
+    FuncCache *funcCache = cached != NULL ? cached->funcCache : new_func_cache();
+    CompiledClass *compiled = compile_source(path, source, len, options, funcCache, state->signatures);
+    set_error_trap(NULL);
+
+    close_vmWriter(compiled->engine->writer);
+    map_set(cache, path, compiled);
+    xprintf("%s: compiled in %.2f ms\n", path, elapsed_ms(&start));
+    print_pass_report(options->passes);
+  }
+
+  if (headerChanged) recompile_others(state, path, options);
+}
+
+static void forget(WatchState *state, char *path, Options *options) {
+  Map *cache = state->compiled;
+  bool headerChanged = update_header(state, path, NULL, 0);
+
+  CompiledClass *cached = map_get(cache, path);
+  if (cached != NULL) {
+    if (cached->engine->writer->outPath != NULL) {
+      unlink(cached->engine->writer->outPath);
+    }
+    map_set(cache, path, NULL);
+    xprintf("%s: removed\n", path);
+  }
+
+  if (headerChanged) recompile_others(state, path, options);
+}
+
+static char *join_path(char *dirPath, char *name) {
+  StringBuilder *sb = new_sb();
+  sb_concat_strings(sb, 3, dirPath, "/", name);
+  char *path = sb_get(sb);
+  free(sb);
+  return path;
+}
+
+static bool contains_path(Vector *paths, char *path) {
+  for (int i = 0; i < paths->len; i++) {
+    if (!strcmp(vec_get(paths, i), path)) return true;
+  }
+  return false;
+}
+
+// compiler --watch <dir>: keeps every compiled class in memory and only
+// recompiles the classes whose files are written, created or moved in
+void watch_directory(char *dirPath, Options *options) {
+  WatchState state = {new_map(), new_map(), NULL};
+
+  int fd = inotify_init1(IN_CLOEXEC);
+  if (fd < 0 || inotify_add_watch(fd, dirPath, IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM) < 0) {
+    xprintf("could not watch %s\n", dirPath);
+    exit(EXIT_FAILURE);
+  }
+
+  // every header is known before the first class is compiled
+  Vector *paths = list_jack_files(dirPath);
+  for (int i = 0; i < paths->len; i++) {
+    size_t len;
+    char *source = read_whole_file(vec_get(paths, i), &len);
+    if (source == NULL) continue;
+    map_set(state.headers, vec_get(paths, i), scan_class_header(source, len));
+    free(source);
+  }
+  rebuild_signatures(&state);
+
+  for (int i = 0; i < paths->len; i++) {
+    recompile(&state, vec_get(paths, i), options, false);
+  }
+  xprintf("watching %s\n", dirPath);
+  fflush(stdout);
+
+  char *buffer = malloc(EVENT_BUFFER_SIZE);
+
+  while (true) {
+    ssize_t n = read(fd, buffer, EVENT_BUFFER_SIZE);
+    if (n <= 0) break;
+
+    // an editor usually produces several events per save, so the
+    // events of one read are collapsed into one recompilation per file
+    Vector *changed = new_vec();
+    for (char *ptr = buffer; ptr < buffer + n;) {
+      struct inotify_event *event = (struct inotify_event *) ptr;
+      ptr += sizeof(struct inotify_event) + event->len;
+
+      if (event->len == 0) continue;
+      char *path = join_path(dirPath, event->name);
+      if (!has_jack_extension(path)) {
+        free(path);
+        continue;
+      }
+
+      if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+        forget(&state, path, options);
+      } else if (!contains_path(changed, path)) {
+        vec_push(changed, path);
+      }
+    }
+
+    for (int i = 0; i < changed->len; i++) {
+      recompile(&state, vec_get(changed, i), options, false);
+    }
+    fflush(stdout);
+  }
+
+  close(fd);
+}
@@ -0,0 +1,9 @@
+
+#ifndef COMPILER_WATCH_H
+#define COMPILER_WATCH_H
+
+#include "options.h"
+
+void watch_directory(char *dirPath, Options *options);
+
+#endif //COMPILER_WATCH_H
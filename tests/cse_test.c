@@ -0,0 +1,140 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/pass_manager.h"
+#include "../src/vm_ir.h"
+
+// Runs the IR passes of -O2 and -Os over subroutines whose meaning they once
+// changed and compares what the code returns before and after.
+
+#define MEMORY_SIZE 512
+#define STACK_SIZE 64
+
+// a model of the VM for code without calls; locals start at 0
+static int execute(IrFunction *ir, int *memory) {
+  int stack[STACK_SIZE];
+  int sp = 0;
+  int segments[8][16] = {{0}};
+
+  for (int pc = 1; pc < ir->len; pc++) {
+    IrInstr *instr = &ir->code[pc];
+    int *slot = NULL;
+    if (instr->op == IR_PUSH || instr->op == IR_POP) {
+      if (instr->arg == SEGMENT_THIS || instr->arg == SEGMENT_THAT) {
+        int pointer = segments[SEGMENT_POINTER][instr->arg == SEGMENT_THIS ? 0 : 1];
+        slot = &memory[(pointer + instr->operand) % MEMORY_SIZE];
+      } else {
+        slot = &segments[instr->arg][instr->operand];
+      }
+    }
+
+    switch (instr->op) {
+      case IR_PUSH:
+        stack[sp++] = instr->arg == SEGMENT_CONST ? instr->operand : *slot;
+        break;
+      case IR_POP:
+        *slot = stack[--sp];
+        break;
+      case IR_ARITHMETIC: {
+        int y = stack[--sp];
+        if (instr->arg == NEG || instr->arg == NOT) {
+          stack[sp++] = (int16_t) (instr->arg == NEG ? -y : ~y);
+          break;
+        }
+        int x = stack[--sp];
+        int results[] = {x + y, x - y, 0, x == y ? -1 : 0, x > y ? -1 : 0, x < y ? -1 : 0, x & y, x | y};
+        stack[sp++] = (int16_t) results[instr->arg];
+        break;
+      }
+      case IR_GOTO:
+      case IR_IF_GOTO:
+        if (instr->op == IR_IF_GOTO && stack[--sp] == 0) break;
+        for (int target = 1; target < ir->len; target++) {
+          if (ir->code[target].op == IR_LABEL && ir->code[target].name == instr->name) pc = target;
+        }
+        break;
+      case IR_RETURN:
+        return stack[--sp];
+      default:
+        break;
+    }
+  }
+  return 0;
+}
+
+static void emit(IrFunction *ir, IrOp op, int arg, int operand, char *label) {
+  ir_append(ir, ir_instr(op, arg, operand, label != NULL ? ir_intern(ir, NULL, label) : -1));
+}
+
+// push local array; push constant index; add; pop pointer 1; push that 0; pop local to
+static void read_element(IrFunction *ir, int array, int index, int to) {
+  emit(ir, IR_PUSH, SEGMENT_LOCAL, array, NULL);
+  emit(ir, IR_PUSH, SEGMENT_CONST, index, NULL);
+  emit(ir, IR_ARITHMETIC, ADD, 0, NULL);
+  emit(ir, IR_POP, SEGMENT_POINTER, 1, NULL);
+  emit(ir, IR_PUSH, SEGMENT_THAT, 0, NULL);
+  emit(ir, IR_POP, SEGMENT_LOCAL, to, NULL);
+}
+
+// var Array a, b; var int x, z, w, c;
+// let x = a[1]; let z = b[0]; let w = a[1];
+// if (~(w = 0)) { let c = a[2]; }
+// return c;
+// CSE once read w from x and dropped its pointer 1, which array-offsets had
+// left in place for the then-branch, so a[2] was read from b.
+static IrFunction *pointer_across_branch(void) {
+  IrFunction *ir = new_ir_function();
+  ir_append(ir, ir_instr(IR_FUNCTION, 0, 6, ir_intern(ir, "Main", "main")));
+  emit(ir, IR_PUSH, SEGMENT_CONST, 100, NULL);
+  emit(ir, IR_POP, SEGMENT_LOCAL, 0, NULL);
+  emit(ir, IR_PUSH, SEGMENT_CONST, 200, NULL);
+  emit(ir, IR_POP, SEGMENT_LOCAL, 1, NULL);
+  read_element(ir, 0, 1, 2);
+  read_element(ir, 1, 0, 3);
+  read_element(ir, 0, 1, 4);
+  emit(ir, IR_PUSH, SEGMENT_LOCAL, 4, NULL);
+  emit(ir, IR_PUSH, SEGMENT_CONST, 0, NULL);
+  emit(ir, IR_ARITHMETIC, EQ, 0, NULL);
+  emit(ir, IR_IF_GOTO, 0, 0, "IF_FALSE0");
+  read_element(ir, 0, 2, 5);
+  emit(ir, IR_LABEL, 0, 0, "IF_FALSE0");
+  emit(ir, IR_PUSH, SEGMENT_LOCAL, 5, NULL);
+  emit(ir, IR_RETURN, 0, 0, NULL);
+  return ir;
+}
+
+static void fill_memory(int *memory) {
+  for (int i = 0; i < MEMORY_SIZE; i++) memory[i] = 0;
+  memory[101] = 5;
+  memory[102] = 7;
+  memory[200] = 1;
+  memory[202] = 200;
+}
+
+static bool check(char *name, IrFunction *(*build)(void), OptLevel level) {
+  static const char *LEVELS[] = {"-O0", "-O1", "-O2", "-Os"};
+  int memory[MEMORY_SIZE];
+  IrFunction *ir = build();
+  fill_memory(memory);
+  int expected = execute(ir, memory);
+
+  Class class = {"Main", init_table(), new_vec()};
+  Function func = {"main", FUNCTION, "int", init_table(), new_vec(), 1};
+  run_ir_passes(new_pass_manager(level, NULL, false), &class, &func, ir, NULL);
+  fill_memory(memory);
+  int actual = execute(ir, memory);
+
+  printf("%-24s %s %s\n", name, LEVELS[level], actual == expected ? "ok" : "FAILED");
+  if (actual != expected) printf("  returned %i instead of %i\n", actual, expected);
+  free_ir_function(ir);
+  return actual == expected;
+}
+
+int main(void) {
+  int failed = 0;
+  OptLevel levels[] = {OPT_O1, OPT_O2, OPT_OS};
+  for (int l = 0; l < 3; l++) {
+    if (!check("pointer-across-branch", pointer_across_branch, levels[l])) failed++;
+  }
+  return failed == 0 ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,220 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/peephole.h"
+#include "../src/util.h"
+
+// A small model of the VM that runs a window of commands on a random state.
+// Every rule is checked with every binding of its variables (and a choice of
+// commands for its wildcards) against the commands it replaces.
+
+#define STACK_SIZE 16
+#define MEMORY_SIZE 64
+#define RETURNED (-2)
+#define FALL_THROUGH (-1)
+#define N_STATES 64
+
+typedef struct {
+  int stack[STACK_SIZE];
+  int sp;
+  int segments[8][8];
+  int memory[MEMORY_SIZE];
+  // the label jumped to outside of the window, or RETURNED
+  int exit;
+} Machine;
+
+static const IrInstr SAMPLES[] = {
+    {IR_PUSH, SEGMENT_CONST, 5, -1}, {IR_PUSH, SEGMENT_LOCAL, 1, -1}, {IR_POP, SEGMENT_LOCAL, 0, -1},
+    {IR_POP, SEGMENT_THAT, 0, -1}, {IR_ARITHMETIC, ADD, 0, -1}, {IR_ARITHMETIC, NOT, 0, -1},
+    {IR_LABEL, 0, 0, 0}, {IR_GOTO, 0, 0, 1}, {IR_IF_GOTO, 0, 0, 0}, {IR_CALL, 0, 1, 0}, {IR_RETURN, 0, 0, -1},
+};
+
+#define N_SAMPLES ((int) (sizeof(SAMPLES) / sizeof(SAMPLES[0])))
+
+static unsigned next_random(unsigned *seed) {
+  *seed = *seed * 1103515245 + 12345;
+  return (*seed >> 8) & 0xffff;
+}
+
+static void random_machine(Machine *m, unsigned seed) {
+  for (int i = 0; i < STACK_SIZE; i++) m->stack[i] = (int16_t) next_random(&seed);
+  m->sp = 4;
+  for (int s = 0; s < 8; s++) {
+    for (int i = 0; i < 8; i++) m->segments[s][i] = (int16_t) next_random(&seed);
+  }
+  // small pointers, so this and that overlap now and then
+  m->segments[SEGMENT_POINTER][0] = next_random(&seed) & 7;
+  m->segments[SEGMENT_POINTER][1] = next_random(&seed) & 7;
+  for (int i = 0; i < MEMORY_SIZE; i++) m->memory[i] = (int16_t) next_random(&seed);
+  m->exit = FALL_THROUGH;
+}
+
+static int *location(Machine *m, Segment segment, int index) {
+  if (index < 0 || index >= 8 || (segment == SEGMENT_POINTER && index > 1)) return NULL;
+  switch (segment) {
+    case SEGMENT_CONST:
+      return NULL;
+    case SEGMENT_THIS: case SEGMENT_THAT: {
+      int base = m->segments[SEGMENT_POINTER][segment == SEGMENT_THIS ? 0 : 1];
+      return &m->memory[(base + index) & (MEMORY_SIZE - 1)];
+    }
+    default:
+      return &m->segments[segment][index];
+  }
+}
+
+static int find_label(IrInstr *code, int len, int name) {
+  for (int i = 0; i < len; i++) {
+    if (code[i].op == IR_LABEL && code[i].name == name) return i;
+  }
+  return -1;
+}
+
+static bool jump(Machine *m, IrInstr *code, int len, int name, int *pc) {
+  int target = find_label(code, len, name);
+  if (target < 0) {
+    m->exit = name;
+    *pc = len;
+  } else {
+    *pc = target;
+  }
+  return true;
+}
+
+// false if the commands are not valid on this state
+static bool execute(Machine *m, IrInstr *code, int len) {
+  int steps = 0;
+  for (int pc = 0; pc < len; pc++) {
+    if (++steps > 100) return false;
+    IrInstr *instr = &code[pc];
+
+    int pops, pushes;
+    ir_stack_effect(instr, &pops, &pushes);
+    if (m->sp < pops || m->sp - pops + pushes > STACK_SIZE) return false;
+
+    switch (instr->op) {
+      case IR_PUSH: {
+        int *at = location(m, instr->arg, instr->operand);
+        if (at == NULL && instr->arg != SEGMENT_CONST) return false;
+        m->stack[m->sp++] = at != NULL ? *at : instr->operand;
+        break;
+      }
+      case IR_POP: {
+        int *at = location(m, instr->arg, instr->operand);
+        if (at == NULL) return false;
+        *at = m->stack[--m->sp];
+        if (instr->arg == SEGMENT_POINTER) *at &= 7;
+        break;
+      }
+      case IR_ARITHMETIC: {
+        int y = m->stack[--m->sp];
+        if (instr->arg == NEG || instr->arg == NOT) {
+          m->stack[m->sp++] = (int16_t) (instr->arg == NEG ? -y : ~y);
+          break;
+        }
+        int x = m->stack[--m->sp];
+        int results[] = {x + y, x - y, 0, x == y ? -1 : 0, x > y ? -1 : 0, x < y ? -1 : 0, x & y, x | y};
+        m->stack[m->sp++] = (int16_t) results[instr->arg];
+        break;
+      }
+      case IR_LABEL:
+        break;
+      case IR_GOTO:
+        jump(m, code, len, instr->name, &pc);
+        break;
+      case IR_IF_GOTO:
+        if (m->stack[--m->sp] != 0) jump(m, code, len, instr->name, &pc);
+        break;
+      case IR_CALL: {
+        // some function of the arguments that also changes a static
+        int result = 17;
+        for (int i = 0; i < instr->operand; i++) result = result * 31 + m->stack[--m->sp];
+        m->stack[m->sp++] = (int16_t) result;
+        m->segments[SEGMENT_STATIC][0]++;
+        break;
+      }
+      case IR_RETURN:
+        m->sp--;
+        m->exit = RETURNED;
+        pc = len;
+        break;
+      default:
+        return false;
+    }
+  }
+  return true;
+}
+
+static bool same_machine(Machine *a, Machine *b) {
+  return a->sp == b->sp && !memcmp(a->stack, b->stack, sizeof(int) * a->sp) &&
+         !memcmp(a->segments, b->segments, sizeof(a->segments)) &&
+         !memcmp(a->memory, b->memory, sizeof(a->memory)) && a->exit == b->exit;
+}
+
+// how many values a variable or wildcard of the self check ranges over:
+// every segment, two indices, two labels and the sample commands
+static int domain_size(const Rule *rule, int slot) {
+  if (slot >= N_VARS) return rule->pattern[slot - N_VARS].op == ANY ? N_SAMPLES : 1;
+  return slot == 0 || slot == 1 ? 8 : 2;
+}
+
+// runs the window and its replacement on random states; false on a difference
+static bool check_instance(const Rule *rule, IrInstr *window) {
+  int bindings[N_VARS];
+  if (!peephole_match(rule, window, bindings)) return true;
+
+  IrInstr replacement[MAX_WINDOW];
+  int len = peephole_instantiate(rule->replacement, rule->replacementLen, bindings, replacement);
+
+  for (unsigned state = 0; state < N_STATES; state++) {
+    Machine before, after;
+    random_machine(&before, state * 7919 + 1);
+    after = before;
+    if (!execute(&before, window, rule->len)) continue;
+    if (!execute(&after, replacement, len) || !same_machine(&before, &after)) {
+      xprintf("peephole rule %s changes the result of:\n", rule->name);
+      for (int i = 0; i < rule->len; i++) {
+        xprintf("  op %i arg %i operand %i name %i\n", window[i].op, window[i].arg, window[i].operand, window[i].name);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool check_rule(const Rule *rule) {
+  // slots 0..N_VARS-1 are the variables, the rest the wildcard commands
+  int slots[N_VARS + MAX_WINDOW] = {0};
+  int nSlots = N_VARS + rule->len;
+
+  while (true) {
+    IrInstr window[MAX_WINDOW];
+    for (int i = 0; i < rule->len; i++) {
+      const Template *t = &rule->pattern[i];
+      if (t->op == ANY) {
+        window[i] = SAMPLES[slots[N_VARS + i]];
+      } else {
+        peephole_instantiate(t, 1, slots, &window[i]);
+      }
+    }
+    if (!check_instance(rule, window)) return false;
+
+    int slot = 0;
+    while (slot < nSlots && ++slots[slot] == domain_size(rule, slot)) {
+      slots[slot++] = 0;
+    }
+    if (slot == nSlots) return true;
+  }
+}
+
+// checks that every rule keeps the meaning of the commands it replaces
+int main(void) {
+  int failed = 0;
+  for (int r = 0; r < N_PEEPHOLE_RULES; r++) {
+    bool ok = check_rule(&PEEPHOLE_RULES[r]);
+    printf("%-20s %s\n", PEEPHOLE_RULES[r].name, ok ? "ok" : "FAILED");
+    if (!ok) failed++;
+  }
+  return failed == 0 ? 0 : EXIT_FAILURE;
+}